@@ -0,0 +1,61 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "common.h"
+
+// Global connection cap; connections beyond this are rejected right after accept()
+#define MAX_CONNECTIONS 1024
+// Gateway sessions (all links together) have their own cap: they cost no fd or thread
+#define MAX_SESSIONS 131072
+
+// Overload controller: a monitor thread samples its own wake-up lag and the number
+// of commands in flight every tick, and raises the level when either gets too high.
+#define OVERLOAD_TICK_MS 50
+#define OVERLOAD_LAG_MS_1 20                   // Scheduler lag to start shedding lobby listings
+#define OVERLOAD_LAG_MS_2 100                  // ...and new logins / rooms / connections
+#define OVERLOAD_INFLIGHT_1 64                 // Commands in flight for level 1
+#define OVERLOAD_INFLIGHT_2 256                // ...and level 2
+#define OVERLOAD_RECOVER_TICKS 20              // Calm ticks before stepping a level down
+
+// Op classes, cheapest to shed first
+typedef enum {
+    ADMIT_LOBBY = 0,                           // LIST_ROOMS
+    ADMIT_SESSION,                             // LOGIN, CREATE_ROOM, JOIN_ROOM
+    ADMIT_GAME,                                // PLACE_LINE (never shed)
+    ADMIT_CONTROL,                             // PING, STATS, anything else
+    ADMIT_NUM_CLASSES
+} AdmitClass;
+
+typedef enum {
+    ADMIT_OK = 0,
+    ADMIT_RATE_LIMITED,
+    ADMIT_SHED
+} AdmitVerdict;
+
+// Token bucket, refilled lazily when checked
+typedef struct {
+    double tokens;
+    double last;                               // Monotonic seconds at last refill
+} TokenBucket;
+
+// Per-connection limiter state
+typedef struct {
+    TokenBucket buckets[ADMIT_NUM_CLASSES];
+} ConnLimits;
+
+// Admission functions
+void admission_init(void);
+int admission_connection_open(void);
+void admission_connection_adopt(void);
+void admission_connection_close(void);
+int admission_session_open(void);
+void admission_session_adopt(void);
+void admission_session_close(void);
+void admission_conn_init(ConnLimits* limits);
+AdmitClass admission_classify(const char* op);
+AdmitVerdict admission_check(ConnLimits* limits, AdmitClass cls);
+void admission_command_begin(void);
+void admission_command_end(void);
+char* admission_stats_to_json(void);
+
+#endif // ADMISSION_H
@@ -0,0 +1,16 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "game.h"
+#include "archive_format.h"
+
+#define ARCHIVE_DEFAULT_PATH "games.dab"
+#define ARCHIVE_QUEUE_LEN 1024                 // Finished games waiting for the writer
+#define ARCHIVE_FLUSH_SECS 5                   // Flush a partial block after this long
+
+// Archiver functions
+int archive_init(const char* path);
+void archive_submit(const GameState* game, char usernames[2][MAX_USERNAME]);
+void archive_shutdown(void);
+
+#endif // ARCHIVE_H
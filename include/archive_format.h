@@ -0,0 +1,41 @@
+#ifndef ARCHIVE_FORMAT_H
+#define ARCHIVE_FORMAT_H
+
+#include <stdint.h>
+
+// On-disk layout of the finished-game archive (see archive.h for the writer).
+//
+// The file is an append-only sequence of blocks. Each block is a fixed header
+// followed by `payload_size` bytes holding `num_games` games stored column by
+// column, so a scan only touches the columns it needs:
+//
+//   rows       u8[n]    dots per side (grid rows)
+//   cols       u8[n]    dots per side (grid cols)
+//   winner     i8[n]    -1=draw, 0=player1, 1=player2
+//   score0     u8[n]
+//   score1     u8[n]
+//   num_moves  u8[n]
+//   moves      u8[sum(num_moves)]   one byte per move (MOVE_ENCODE in game.h)
+//   names      per game: u8 len + bytes for player1, then the same for player2
+//
+// Integers in the header are host byte order (little-endian on supported targets).
+
+#define ARCHIVE_MAGIC "DABA"
+#define ARCHIVE_VERSION 1
+
+// Block codecs (header.codec); readers skip blocks with a codec they don't know
+#define ARCHIVE_CODEC_RAW 0
+#define ARCHIVE_CODEC_PARTIAL 0xffff  // Cut short by a failed write; payload is whatever got out
+
+// Games per block before the writer flushes it
+#define ARCHIVE_BLOCK_GAMES 512
+
+typedef struct {
+    char magic[4];              // ARCHIVE_MAGIC
+    uint16_t version;           // ARCHIVE_VERSION
+    uint16_t codec;             // ARCHIVE_CODEC_*
+    uint32_t num_games;         // Games in this block
+    uint32_t payload_size;      // Bytes following the header
+} ArchiveBlockHeader;
+
+#endif // ARCHIVE_FORMAT_H
@@ -0,0 +1,42 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdint.h>
+#include "common.h"
+
+// Cluster mode: with DAB_DIRECTORY=host:port set, the server registers with a room
+// directory (dab-directory) under DAB_NODE_ADDR (default 127.0.0.1:<port>) and keeps
+// its member list. A new room is placed by consistent hashing of room_id over that
+// list (every node builds the same ring), and the node it lands on claims the id
+// at the directory, which keeps room_id -> node. Existing rooms are found through
+// that record, so they stay reachable when nodes join or leave.
+// Without DAB_DIRECTORY every room is local, as before.
+#define CLUSTER_MAX_NODES 32
+#define CLUSTER_VNODES 64                      // Ring points per node, evens out placement
+#define CLUSTER_ADDR_LEN 64                    // "host:port"
+#define CLUSTER_RETRY_SECS 1                   // Directory reconnect interval
+#define CLUSTER_REGISTER_TIMEOUT_MS 2000       // Connect + first reply from the directory
+#define CLUSTER_QUERY_TIMEOUT_MS 500           // Connect / reply budget for CLAIM and LOCATE
+#define CLUSTER_LINK_QUERY_TIMEOUT_MS 100      // The same from a gateway session: its link waits meanwhile
+#define CLUSTER_QUERY_CONNS 4                  // Directory connections for CLAIM/LOCATE, one request each
+#define CLUSTER_PEER_TIMEOUT_MS 500            // Connect / reply budget per peer when refreshing room lists
+#define CLUSTER_LIST_REFRESH_MS 1000           // How often other nodes' rooms are fetched for LIST_ROOMS
+#define CLUSTER_LIST_BYTES (BUFFER_SIZE * 2 - 64)  // Aggregated ROOM_LIST, fits one gateway frame
+
+typedef void (*cluster_room_fn)(const char* room_id, void* ctx);
+
+// Cluster functions
+void cluster_init(int port);
+void cluster_set_room_source(void (*for_each_room)(cluster_room_fn fn, void* ctx));
+void cluster_register(void);
+int cluster_enabled(void);
+int cluster_owner(const char* room_id, char* node_out, size_t cap);
+int cluster_claim_room(const char* room_id, char* node_out, size_t cap, int timeout_ms);
+int cluster_locate_room(const char* room_id, char* node_out, size_t cap, int timeout_ms);
+void cluster_release_room(const char* room_id);
+void cluster_leave(void);
+int cluster_peer_rooms(char* buf, size_t cap, int pos, int* first);
+uint64_t cluster_hash(const char* key);
+int cluster_parse_addr(const char* addr, char* host, size_t host_cap, int* port);
+
+#endif // CLUSTER_H
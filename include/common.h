@@ -14,7 +14,9 @@
 
 // Configuration
 #define SERVER_PORT 50000
+#define DIRECTORY_PORT 50100                   // dab-directory (cluster mode)
 #define MAX_CLIENTS 10
+#define LISTEN_BACKLOG 128
 #define BUFFER_SIZE 4096
 #define MAX_USERNAME 32
 #define MAX_ROOM_ID 32
@@ -39,6 +41,18 @@
 #define MSG_ERROR "ERROR"
 #define MSG_PING "PING"
 #define MSG_PONG "PONG"
+#define MSG_STATS "STATS"
+#define MSG_TRACE_DUMP "TRACE_DUMP"
+#define MSG_MUX_HELLO "MUX_HELLO"
+#define MSG_MUX_READY "MUX_READY"
+#define MSG_REDIRECT "REDIRECT"
+#define MSG_REGISTER "REGISTER"
+#define MSG_NODES "NODES"
+#define MSG_LEAVE "LEAVE"
+#define MSG_CLAIM "CLAIM"
+#define MSG_LOCATE "LOCATE"
+#define MSG_RELEASE "RELEASE"
+#define MSG_ROOM_OWNER "ROOM_OWNER"
 
 // Orientation
 #define ORIENTATION_HORIZONTAL "H"
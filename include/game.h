@@ -3,6 +3,13 @@
 
 #include "common.h"
 
+// Move log: at most one entry per edge on the largest board
+#define MAX_MOVES (2 * MAX_GRID_SIZE * (MAX_GRID_SIZE - 1))
+
+// Moves are logged as one byte: bit 7 = vertical, low bits = y * MAX_GRID_SIZE + x
+#define MOVE_VERTICAL 0x80
+#define MOVE_ENCODE(x, y, vertical) ((unsigned char)(((vertical) ? MOVE_VERTICAL : 0) | ((y) * MAX_GRID_SIZE + (x))))
+
 // Game state structure
 typedef struct {
     int rows;
@@ -14,6 +21,8 @@ typedef struct {
     int current_turn;                      // 0 or 1
     int game_over;                         // 0=playing, 1=finished
     int winner;                            // -1=draw, 0=player1, 1=player2
+    unsigned char moves[MAX_MOVES];        // Applied moves in order (MOVE_ENCODE)
+    int num_moves;
 } GameState;
 
 // Room structure
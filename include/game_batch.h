@@ -0,0 +1,68 @@
+#ifndef GAME_BATCH_H
+#define GAME_BATCH_H
+
+#include <stdint.h>
+#include "game.h"
+
+// Batch rules engine: many positions of one board size, stored structure-of-arrays
+// as bitplanes so moves can be applied to several lanes per instruction.
+//
+// Edge bits (per lane, in edges[]):
+//   horizontal (x, y): y * (cols - 1) + x                      y < rows, x < cols - 1
+//   vertical   (x, y): rows * (cols - 1) + y * cols + x        y < rows - 1, x < cols
+// Box bits: by * (cols - 1) + bx.
+// owners[] holds player 1's boxes in bits 0-31, player 2's in bits 32-63, plus
+// BATCH_TURN_BIT (player 2 to move) and BATCH_OVER_BIT (game over).
+//
+// Moves are applied for the lane's current player. Results and resulting positions
+// match place_line(game, x, y, o, game->current_turn); the move log is not kept.
+
+#define BATCH_MAX_EDGES 64
+#define BATCH_MAX_BOXES 32
+#define BATCH_NO_MOVE 0xFF                     // Lane is left untouched (result -1)
+#define BATCH_TURN_BIT (1ull << 62)
+#define BATCH_OVER_BIT (1ull << 63)
+#define BATCH_P2_SHIFT 32
+
+typedef enum {
+    BATCH_ISA_SCALAR = 0,
+    BATCH_ISA_SSE42,
+    BATCH_ISA_AVX2
+} BatchIsa;
+
+typedef struct {
+    int rows;                                  // Dots, same for every lane
+    int cols;
+    int count;                                 // Lanes in use
+    int num_edges;
+    int num_boxes;
+    uint64_t all_edges;                        // Mask of valid edge bits
+    uint64_t all_boxes;                        // Mask of valid box bits
+    uint64_t* edges;                           // Drawn edges per lane
+    uint64_t* owners;                          // Box ownership + turn/over flags per lane
+    // Per edge: the (up to) two boxes it borders, as edge masks and box bits
+    uint64_t box_edges_a[BATCH_MAX_EDGES];
+    uint64_t box_edges_b[BATCH_MAX_EDGES];
+    uint64_t box_bit_a[BATCH_MAX_EDGES];
+    uint64_t box_bit_b[BATCH_MAX_EDGES];
+    uint64_t box_edges[BATCH_MAX_BOXES];       // All four edges of each box
+    BatchIsa isa;
+} GameBatch;
+
+// Batch functions
+GameBatch* batch_create(int size, int count);
+void batch_free(GameBatch* batch);
+void batch_set_isa(GameBatch* batch, BatchIsa isa);
+const char* batch_isa_name(BatchIsa isa);
+int batch_edge_index(const GameBatch* batch, int x, int y, const char* orientation);
+void batch_edge_coords(const GameBatch* batch, int edge, int* x, int* y, const char** orientation);
+void batch_load(GameBatch* batch, int lane, const GameState* game);
+void batch_store(const GameBatch* batch, int lane, GameState* game);
+
+// Kernels (vectorized where the CPU allows)
+void batch_apply_moves(GameBatch* batch, const uint8_t* moves, int8_t* results);
+void batch_legal_moves(const GameBatch* batch, uint64_t* legal);
+void batch_completed_boxes(const GameBatch* batch, uint32_t* completed);
+void batch_scores(const GameBatch* batch, uint8_t* scores0, uint8_t* scores1);
+
+#endif // GAME_BATCH_H
@@ -14,6 +14,8 @@ char* create_place_line_message(int x, int y, const char* orientation);
 char* create_error_message(const char* error_msg);
 char* create_ping_message(void);
 char* create_pong_message(void);
+char* create_redirect_message(const char* room_id, const char* node);
+char* create_directory_room_message(const char* op, const char* room_id, const char* node);
 
 // Parse incoming messages
 json_object* parse_json_message(const char* msg);
@@ -3,21 +3,68 @@
 
 #include "common.h"
 #include "game.h"
+#include "admission.h"
 
-#define MAX_ROOMS 10
+#define MAX_ROOMS 10                           // Room slots unless DAB_MAX_ROOMS says otherwise
+#define MAX_ROOMS_LIMIT 100000                 // Largest DAB_MAX_ROOMS accepted
 
-// Client structure
+// Shutdown / restart
+#define STOP_POLL_MS 200                       // How often idle readers and the accept loop check for a stop
+#define DRAIN_TIMEOUT_SECS 600                 // Longest a draining shutdown waits for games to finish
+#define HANDOFF_TIMEOUT_SECS 10                // Longest a hot restart waits for handlers / the new process
+#define HANDOFF_ENV "DAB_HANDOFF_FD"           // Set in the new process to the handoff socket fd
+
+#define SERVER_STOP_NONE 0
+#define SERVER_STOP_DRAIN 1                    // Stop accepting, finish games in progress, then close
+#define SERVER_STOP_CLOSE 2                    // Close every connection now
+#define SERVER_STOP_RESTART 3                  // Hand listener, connections and rooms to a new process
+
+// Gateway multiplexing: a trusted gateway carries many sessions over one link (see protocol.md)
+#define MUX_MAX_LINKS 16
+#define MUX_MAX_SIDS MAX_SESSIONS              // Session ids on a link are 0..MUX_MAX_SIDS-1
+#define MUX_SESSION_BASE (1 << 20)             // Session handles (used where fds are) start above any fd
+#define MUX_SESSION_CHUNK 1024                 // The session table grows this many slots at a time
+#define MUX_INITIAL_CREDITS 32                 // Messages a session may receive before the gateway grants more
+#define MUX_PENDING_BYTES 8192                 // Frames held per session while out of credits
+
+// Who a command comes from: a direct connection or a gateway session
 typedef struct {
-    int socket;
+    int socket;                            // fd, or handle for gateway sessions; -1 = free slot
     char username[MAX_USERNAME];
     int player_id;
     char current_room[MAX_ROOM_ID];
+    ConnLimits limits;
+} Session;
+
+// Client structure (one per connection; everything here survives a hot restart)
+typedef struct {
+    Session session;
     pthread_t thread;
+    char inbuf[BUFFER_SIZE];               // Bytes read but not yet consumed as a line
+    int inbuf_len;
+    int inbuf_skip;                        // Dropping the rest of an overlong line up to its newline
+    int parked;                            // Handler exited for a hot restart, connection kept open
+    int mux_link;                          // Gateway link this connection is, -1 = direct
 } Client;
 
+// Gateway session: no socket or thread of its own, its link's handler runs its commands
+typedef struct {
+    Session session;                       // session.socket = MUX_SESSION_BASE + slot in the session table
+    int mux_link;                          // Gateway link the session rides on
+    int mux_sid;                           // Gateway session id
+    int mux_credits;                       // Messages the gateway will still accept for this session
+    int mux_closing;                       // Server closed the session, waiting for the gateway's C
+    char* mux_pending;                     // Frames held back until the gateway grants credits (allocated on use)
+    int mux_pending_len;
+} MuxSession;
+
 // Server functions
 void init_server(void);
 void start_server(void);
+void server_signal_stop(int mode);
+void server_set_port(int port);
+void server_set_exec_path(const char* path, char** argv);
+int resume_from_handoff(int handoff_fd);
 void* handle_client(void* arg);
 void broadcast_to_room(const char* room_id, const char* message, int exclude_fd);
 void send_message(int socket, const char* message);
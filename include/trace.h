@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Flight recorder: every handler thread appends fixed-size events to its own
+// ring, so recording is a clock read plus a few stores with no locks or shared
+// writes. A dump (SIGUSR1 or the TRACE_DUMP op) copies all rings into a
+// Chrome trace / Perfetto JSON file.
+
+#define TRACE_MAX_RINGS 256                    // Threads recording at once; more are not traced
+#define TRACE_RING_EVENTS 1024                 // Per ring, power of two
+#define TRACE_TAG_LEN 16                       // Room id or op name, truncated
+#define TRACE_DEFAULT_DIR "."
+
+typedef enum {
+    TRACE_FRAME_RECEIVED = 0,                  // Line read from the socket
+    TRACE_PARSED,                              // JSON parsed (tag = op)
+    TRACE_ROOM_RESOLVED,                       // Room looked up (tag = room id)
+    TRACE_MOVE_APPLIED,                        // place_line() returned
+    TRACE_SERIALIZED,                          // Reply / state JSON built
+    TRACE_QUEUED,                              // Handed to send_message()
+    TRACE_WRITTEN,                             // write() returned
+    TRACE_NUM_EVENTS
+} TraceEventType;
+
+typedef struct {
+    uint64_t ts_ns;                            // CLOCK_MONOTONIC
+    int32_t conn;                              // Client socket the event is about
+    uint16_t type;                             // TraceEventType
+    uint16_t pad;
+    char tag[TRACE_TAG_LEN];
+} TraceEvent;
+
+// Trace functions
+void trace_init(void);
+void trace_event(TraceEventType type, int conn, const char* tag);
+void trace_thread_release(void);
+void trace_request_dump(void);
+void trace_poll_dump(void);
+int trace_dump(char* path_out, size_t path_cap);
+
+#endif // TRACE_H
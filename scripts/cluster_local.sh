@@ -0,0 +1,111 @@
+#!/bin/bash
+
+# Dots & Boxes - local cluster
+# Runs a room directory plus N server nodes on this machine.
+#
+#   scripts/cluster_local.sh start [nodes]     run until Ctrl+C (nodes on 31001, 31002, ...)
+#   scripts/cluster_local.sh bench [counts]    bench-cluster against clusters of each size (default "1 2 4")
+#
+# Node limits come from MAX_ROOMS and RATE_SCALE (DAB_MAX_ROOMS / DAB_RATE_SCALE on each
+# node; server defaults for start). bench raises them to 1000 and 100 unless set, so
+# it measures the nodes rather than the room cap and the per-connection rate limits.
+#
+# Point the proxy at any node (TCP_PORT=31001); it follows the nodes' redirects.
+
+PROJECT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )/.." && pwd )"
+# Below Linux's ephemeral range (32768+), so the benchmark's many short-lived
+# client connections can't leave a TIME_WAIT socket on a port a node needs
+DIRECTORY_PORT=${DIRECTORY_PORT:-31100}
+BASE_PORT=${BASE_PORT:-31001}
+PAIRS=${PAIRS:-40}
+SECS=${SECS:-10}
+MAX_ROOMS=${MAX_ROOMS:-}
+RATE_SCALE=${RATE_SCALE:-}
+RUN_DIR=$(mktemp -d)
+PIDS=()
+
+cd "$PROJECT_DIR" || exit 1
+for bin in server dab-directory bench-cluster; do
+    if [ ! -x "./$bin" ]; then
+        echo "⚠️  $bin not built. Run: make build"
+        exit 1
+    fi
+done
+
+stop_all() {
+    kill "${PIDS[@]}" 2>/dev/null
+    wait "${PIDS[@]}" 2>/dev/null
+    PIDS=()
+}
+
+cleanup() {
+    stop_all
+    rm -rf "$RUN_DIR"
+}
+trap cleanup EXIT
+trap 'exit 0' SIGINT SIGTERM
+
+# Number of nodes the directory currently lists
+count_nodes() {
+    exec 3<>"/dev/tcp/127.0.0.1/$DIRECTORY_PORT" || return 1
+    echo '{"op":"NODES"}' >&3
+    read -r -t 2 line <&3
+    exec 3>&-
+    echo "$line" | grep -o '"[A-Za-z0-9.-]*:[0-9][0-9]*"' | wc -l
+}
+
+start_cluster() {
+    local nodes=$1
+    ./dab-directory "$DIRECTORY_PORT" 0 >"$RUN_DIR/directory.log" 2>&1 &
+    PIDS+=($!)
+    sleep 0.3
+    for ((i = 0; i < nodes; i++)); do
+        local port=$((BASE_PORT + i))
+        DAB_PORT=$port DAB_DIRECTORY=127.0.0.1:$DIRECTORY_PORT DAB_NODE_ADDR=127.0.0.1:$port \
+            DAB_MAX_ROOMS=$MAX_ROOMS DAB_RATE_SCALE=$RATE_SCALE \
+            DAB_ARCHIVE="$RUN_DIR/node$port.dab" DAB_TRACE=0 ./server >"$RUN_DIR/node$port.log" 2>&1 &
+        PIDS+=($!)
+    done
+    # Wait until every node has registered
+    for _ in $(seq 50); do
+        [ "$(count_nodes)" = "$nodes" ] && return 0
+        sleep 0.1
+    done
+    echo "❌ Only $(count_nodes) of $nodes node(s) registered, see $RUN_DIR"
+    return 1
+}
+
+case "${1:-start}" in
+    start)
+        nodes=${2:-3}
+        start_cluster "$nodes" || exit 1
+        echo "✅ Directory on $DIRECTORY_PORT, $nodes node(s) from port $BASE_PORT (logs in $RUN_DIR)"
+        echo "Press Ctrl+C to stop"
+        wait
+        ;;
+    bench)
+        MAX_ROOMS=${MAX_ROOMS:-1000}
+        RATE_SCALE=${RATE_SCALE:-100}
+        echo "Nodes run with DAB_MAX_ROOMS=$MAX_ROOMS DAB_RATE_SCALE=$RATE_SCALE, $(nproc) CPU(s)"
+        counts=${2:-1 2 4}
+        baseline=""
+        for nodes in $counts; do
+            start_cluster "$nodes" || exit 1
+            result=$(./bench-cluster -e "127.0.0.1:$BASE_PORT" -p "$PAIRS" -d "$SECS")
+            echo "$nodes node(s): $result"
+            # Per-node throughput against the first (smallest) cluster's
+            rate=$(echo "$result" | grep -o '[0-9]* moves/s' | grep -o '[0-9]*')
+            if [ -n "$rate" ]; then
+                per_node=$((rate / nodes))
+                [ -z "$baseline" ] && baseline=$per_node
+                echo "    $per_node moves/s per node, $((per_node * 100 / (baseline > 0 ? baseline : 1)))% of the ${counts%% *}-node figure"
+            fi
+            stop_all
+            sleep 0.5
+        done
+        ;;
+    *)
+        echo "Usage: $0 start [nodes] | bench [counts]"
+        exit 1
+        ;;
+esac
@@ -128,6 +128,35 @@ char* create_pong_message(void) {
     return msg;
 }
 
+char* create_redirect_message(const char* room_id, const char* node) {
+    json_object* jobj = json_object_new_object();
+    json_object_object_add(jobj, "op", json_object_new_string(MSG_REDIRECT));
+    json_object_object_add(jobj, "room_id", json_object_new_string(room_id));
+    json_object_object_add(jobj, "node", json_object_new_string(node));
+    
+    const char* json_str = json_object_to_json_string(jobj);
+    char* msg = malloc(strlen(json_str) + 2);
+    sprintf(msg, "%s\n", json_str);
+    
+    json_object_put(jobj);
+    return msg;
+}
+
+// Room directory requests (CLAIM, LOCATE, RELEASE) and its ROOM_OWNER reply; node may be NULL
+char* create_directory_room_message(const char* op, const char* room_id, const char* node) {
+    json_object* jobj = json_object_new_object();
+    json_object_object_add(jobj, "op", json_object_new_string(op));
+    json_object_object_add(jobj, "room_id", json_object_new_string(room_id));
+    if (node) json_object_object_add(jobj, "node", json_object_new_string(node));
+    
+    const char* json_str = json_object_to_json_string(jobj);
+    char* msg = malloc(strlen(json_str) + 2);
+    sprintf(msg, "%s\n", json_str);
+    
+    json_object_put(jobj);
+    return msg;
+}
+
 json_object* parse_json_message(const char* msg) {
     json_object* jobj = json_tokener_parse(msg);
     if (jobj == NULL) {
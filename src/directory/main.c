@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "common.h"
+#include "protocol.h"
+#include "cluster.h"
+
+// dab-directory: member list and room records for cluster mode. Nodes connect and send
+//   {"op":"REGISTER","node":"host:port"}
+// and keep the connection open; a node is listed while at least one of its
+// connections is (so a hot restart, where old and new process overlap, never
+// drops it). Every change is pushed to all registered nodes as
+//   {"op":"NODES","epoch":<n>,"nodes":["host:port",...]}
+// Anyone may ask for the current list with {"op":"NODES"}. Placement of new rooms
+// is computed by the nodes from this list (see include/cluster.h).
+//
+// Rooms: a node CLAIMs a room_id before creating it and RELEASEs it when the room
+// is deleted; LOCATE finds the holder. Both CLAIM and LOCATE are answered with
+//   {"op":"ROOM_OWNER","room_id":...,"node":"host:port" or ""}
+// A node's claims last while any of its connections does. LEAVE (a draining node)
+// takes it off the list but keeps its claims until it disconnects.
+
+#define DIRECTORY_MAX_CONNS 256
+#define DIRECTORY_ROOM_BUCKETS 4096
+#define DIRECTORY_RECOVERY_SECS 2              // After start, new claims wait for nodes to re-claim their rooms
+
+typedef struct {
+    int fd;                                    // -1 = free slot
+    char node[CLUSTER_ADDR_LEN];               // Registered address, "" if none
+    int leaving;                               // Sent LEAVE: not listed, claims kept
+    char inbuf[BUFFER_SIZE];
+    int inbuf_len;
+} DirConn;
+
+typedef struct DirRoom {
+    char room_id[MAX_ROOM_ID];
+    char node[CLUSTER_ADDR_LEN];
+    struct DirRoom* next;
+} DirRoom;
+
+static DirConn conns[DIRECTORY_MAX_CONNS];
+static DirRoom* room_buckets[DIRECTORY_ROOM_BUCKETS];
+static int num_rooms = 0;
+static int epoch = 0;
+static time_t claims_open_at;
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void send_line(int fd, const char* line) {
+    size_t len = strlen(line);
+    while (len > 0) {
+        ssize_t w = write(fd, line, len);
+        if (w <= 0) return;
+        line += w;
+        len -= (size_t)w;
+    }
+}
+
+// Listed: registered on a connection that hasn't sent LEAVE
+static int node_listed(const char* node, int except) {
+    for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) {
+        if (i != except && conns[i].fd >= 0 && !conns[i].leaving && strcmp(conns[i].node, node) == 0) return 1;
+    }
+    return 0;
+}
+
+static int node_connected(const char* node) {
+    for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) {
+        if (conns[i].fd >= 0 && strcmp(conns[i].node, node) == 0) return 1;
+    }
+    return 0;
+}
+
+// NODES message with each listed address once, in a stable (sorted) order
+static void nodes_message(char* buf, size_t cap) {
+    const char* list[DIRECTORY_MAX_CONNS];
+    int n = 0;
+    for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) {
+        if (conns[i].fd < 0 || !conns[i].node[0] || conns[i].leaving) continue;
+        int dup = 0;
+        for (int j = 0; j < n && !dup; j++) dup = strcmp(list[j], conns[i].node) == 0;
+        if (!dup) list[n++] = conns[i].node;
+    }
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && strcmp(list[j - 1], list[j]) > 0; j--) {
+            const char* t = list[j]; list[j] = list[j - 1]; list[j - 1] = t;
+        }
+    }
+    int pos = snprintf(buf, cap, "{\"op\":\"%s\",\"epoch\":%d,\"nodes\":[", MSG_NODES, epoch);
+    for (int i = 0; i < n && (size_t)pos + CLUSTER_ADDR_LEN + 8 < cap; i++) {
+        pos += snprintf(buf + pos, cap - pos, "%s\"%s\"", i ? "," : "", list[i]);
+    }
+    snprintf(buf + pos, cap - pos, "]}\n");
+}
+
+static void broadcast_nodes(void) {
+    char msg[CLUSTER_MAX_NODES * (CLUSTER_ADDR_LEN + 4) + 128];
+    epoch++;
+    nodes_message(msg, sizeof(msg));
+    printf("epoch %d: %s", epoch, msg);
+    for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) {
+        if (conns[i].fd >= 0 && conns[i].node[0]) send_line(conns[i].fd, msg);
+    }
+}
+
+static DirRoom** room_slot(const char* room_id) {
+    DirRoom** p = &room_buckets[cluster_hash(room_id) % DIRECTORY_ROOM_BUCKETS];
+    while (*p && strcmp((*p)->room_id, room_id) != 0) p = &(*p)->next;
+    return p;
+}
+
+// Gives room_id to node unless someone holds it already; returns the holder
+static const char* claim_room(const char* room_id, const char* node) {
+    DirRoom** p = room_slot(room_id);
+    if (*p) return (*p)->node;
+    DirRoom* r = calloc(1, sizeof(DirRoom));
+    if (!r) return "";
+    strncpy(r->room_id, room_id, MAX_ROOM_ID - 1);
+    strncpy(r->node, node, CLUSTER_ADDR_LEN - 1);
+    *p = r;
+    num_rooms++;
+    return r->node;
+}
+
+static void release_room(const char* room_id, const char* node) {
+    DirRoom** p = room_slot(room_id);
+    if (!*p || strcmp((*p)->node, node) != 0) return;
+    DirRoom* r = *p;
+    *p = r->next;
+    free(r);
+    num_rooms--;
+}
+
+static int drop_node_rooms(const char* node) {
+    int dropped = 0;
+    for (int b = 0; b < DIRECTORY_ROOM_BUCKETS; b++) {
+        DirRoom** p = &room_buckets[b];
+        while (*p) {
+            if (strcmp((*p)->node, node) == 0) {
+                DirRoom* r = *p;
+                *p = r->next;
+                free(r);
+                dropped++;
+            } else {
+                p = &(*p)->next;
+            }
+        }
+    }
+    num_rooms -= dropped;
+    return dropped;
+}
+
+static void send_room_owner(int fd, const char* room_id, const char* node) {
+    char* msg = create_directory_room_message(MSG_ROOM_OWNER, room_id, node);
+    send_line(fd, msg);
+    free(msg);
+}
+
+static void close_conn(int i) {
+    char node[CLUSTER_ADDR_LEN];
+    strcpy(node, conns[i].node);
+    int was_listed = !conns[i].leaving;
+    close(conns[i].fd);
+    conns[i].fd = -1;
+    conns[i].node[0] = '\0';
+    conns[i].leaving = 0;
+    if (!node[0]) return;
+    if (!node_connected(node)) {
+        int dropped = drop_node_rooms(node);
+        if (dropped) printf("dropped %d room(s) of %s\n", dropped, node);
+    }
+    if (was_listed && !node_listed(node, -1)) {
+        printf("node left: %s\n", node);
+        broadcast_nodes();
+    }
+}
+
+static void handle_line(int i, const char* line) {
+    json_object* jobj = json_tokener_parse(line);
+    json_object* op;
+    if (!jobj || !json_object_object_get_ex(jobj, "op", &op)) {
+        send_line(conns[i].fd, "{\"op\":\"ERROR\",\"msg\":\"Invalid JSON\"}\n");
+        if (jobj) json_object_put(jobj);
+        return;
+    }
+    const char* name = json_object_get_string(op);
+    json_object* no;
+    json_object* ro;
+    const char* node = json_object_object_get_ex(jobj, "node", &no) ? json_object_get_string(no) : NULL;
+    const char* room_id = json_object_object_get_ex(jobj, "room_id", &ro) ? json_object_get_string(ro) : NULL;
+    if (room_id && strlen(room_id) >= MAX_ROOM_ID) room_id = NULL;
+    if (strcmp(name, MSG_REGISTER) == 0 && node) {
+        char host[CLUSTER_ADDR_LEN];
+        int port;
+        if (conns[i].node[0] || cluster_parse_addr(node, host, sizeof(host), &port) < 0) {
+            send_line(conns[i].fd, "{\"op\":\"ERROR\",\"msg\":\"Invalid registration\"}\n");
+        } else {
+            int known = node_listed(node, i);
+            strncpy(conns[i].node, node, CLUSTER_ADDR_LEN - 1);
+            if (known) {
+                char msg[CLUSTER_MAX_NODES * (CLUSTER_ADDR_LEN + 4) + 128];
+                nodes_message(msg, sizeof(msg));
+                send_line(conns[i].fd, msg);
+            } else {
+                printf("node joined: %s\n", node);
+                broadcast_nodes();
+            }
+        }
+    } else if (strcmp(name, MSG_LEAVE) == 0 && conns[i].node[0]) {
+        if (!conns[i].leaving) {
+            conns[i].leaving = 1;
+            if (!node_listed(conns[i].node, -1)) {
+                printf("node leaving: %s\n", conns[i].node);
+                broadcast_nodes();
+            }
+        }
+    } else if (strcmp(name, MSG_CLAIM) == 0 && room_id && node) {
+        // A node re-claiming on its registration connection is restoring rooms it
+        // already has; a new claim must wait until those are back and needs a listed node
+        int reclaim = strcmp(conns[i].node, node) == 0;
+        if (!reclaim && time(NULL) < claims_open_at) {
+            send_line(conns[i].fd, "{\"op\":\"ERROR\",\"msg\":\"Directory recovering\"}\n");
+        } else if (!reclaim && !node_listed(node, -1)) {
+            send_line(conns[i].fd, "{\"op\":\"ERROR\",\"msg\":\"Node not registered\"}\n");
+        } else {
+            send_room_owner(conns[i].fd, room_id, claim_room(room_id, node));
+        }
+    } else if (strcmp(name, MSG_LOCATE) == 0 && room_id) {
+        DirRoom** p = room_slot(room_id);
+        send_room_owner(conns[i].fd, room_id, *p ? (*p)->node : "");
+    } else if (strcmp(name, MSG_RELEASE) == 0 && room_id && node) {
+        release_room(room_id, node);
+    } else if (strcmp(name, MSG_NODES) == 0) {
+        char msg[CLUSTER_MAX_NODES * (CLUSTER_ADDR_LEN + 4) + 128];
+        nodes_message(msg, sizeof(msg));
+        send_line(conns[i].fd, msg);
+    } else if (strcmp(name, MSG_PING) == 0) {
+        send_line(conns[i].fd, "{\"op\":\"PONG\"}\n");
+    } else {
+        send_line(conns[i].fd, "{\"op\":\"ERROR\",\"msg\":\"Unknown op\"}\n");
+    }
+    json_object_put(jobj);
+}
+
+int main(int argc, char** argv) {
+    int port = argc > 1 ? atoi(argv[1]) : DIRECTORY_PORT;
+    // A fresh cluster has nothing to recover: "dab-directory <port> 0"
+    int recovery_secs = argc > 2 ? atoi(argv[2]) : DIRECTORY_RECOVERY_SECS;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, LISTEN_BACKLOG) < 0) {
+        perror("directory");
+        return 1;
+    }
+    for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) conns[i].fd = -1;
+    claims_open_at = time(NULL) + recovery_secs;
+    printf("Room directory listening on TCP %d\n", port);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // One thread, one poll loop: every message here is tiny
+    struct pollfd pfds[DIRECTORY_MAX_CONNS + 1];
+    int slots[DIRECTORY_MAX_CONNS + 1];
+    while (!stopping) {
+        int n = 0;
+        pfds[n].fd = listen_fd; pfds[n].events = POLLIN; slots[n++] = -1;
+        for (int i = 0; i < DIRECTORY_MAX_CONNS; i++) {
+            if (conns[i].fd < 0) continue;
+            pfds[n].fd = conns[i].fd; pfds[n].events = POLLIN; slots[n++] = i;
+        }
+        if (poll(pfds, (nfds_t)n, -1) <= 0) continue;
+        for (int k = 1; k < n; k++) {
+            if (!pfds[k].revents) continue;
+            DirConn* c = &conns[slots[k]];
+            ssize_t r = read(c->fd, c->inbuf + c->inbuf_len, sizeof(c->inbuf) - 1 - c->inbuf_len);
+            if (r <= 0) { close_conn(slots[k]); continue; }
+            c->inbuf_len += (int)r;
+            char* nl;
+            while (c->fd >= 0 && (nl = memchr(c->inbuf, '\n', c->inbuf_len)) != NULL) {
+                *nl = '\0';
+                handle_line(slots[k], c->inbuf);
+                int used = (int)(nl - c->inbuf) + 1;
+                memmove(c->inbuf, c->inbuf + used, c->inbuf_len - used);
+                c->inbuf_len -= used;
+            }
+            if (c->inbuf_len == (int)sizeof(c->inbuf) - 1) close_conn(slots[k]);
+        }
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0) continue;
+            int slot = -1;
+            for (int i = 0; i < DIRECTORY_MAX_CONNS && slot < 0; i++) if (conns[i].fd < 0) slot = i;
+            if (slot < 0) { close(fd); continue; }
+            conns[slot].fd = fd;
+            conns[slot].node[0] = '\0';
+            conns[slot].leaving = 0;
+            conns[slot].inbuf_len = 0;
+        }
+    }
+    printf("Room directory stopped (%d room(s) recorded)\n", num_rooms);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "admission.h"
+
+// Per-class token bucket limits: sustained rate (ops/s) and burst size
+static const double class_rate[ADMIT_NUM_CLASSES]  = { 2.0,  5.0, 20.0, 10.0 };
+static const double class_burst[ADMIT_NUM_CLASSES] = { 5.0, 10.0, 40.0, 20.0 };
+static const char* class_names[ADMIT_NUM_CLASSES] = { "lobby", "session", "game", "control" };
+static double rate_scale = 1.0;                // DAB_RATE_SCALE: multiplies every rate and burst
+
+static atomic_int connections;
+static atomic_int sessions;
+static atomic_int inflight;
+static atomic_int overload_level;
+static atomic_int lag_ms;
+
+// Exported counters
+static atomic_ulong conn_accepted;
+static atomic_ulong conn_rejected_cap;
+static atomic_ulong conn_rejected_overload;
+static atomic_ulong rate_limited[ADMIT_NUM_CLASSES];
+static atomic_ulong shed[ADMIT_NUM_CLASSES];
+static atomic_ulong level_raises;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* overload_monitor(void* arg) {
+    (void)arg;
+    int calm = 0;
+    struct timespec tick = { 0, OVERLOAD_TICK_MS * 1000000L };
+    while (1) {
+        double before = now_seconds();
+        nanosleep(&tick, NULL);
+        int lag = (int)((now_seconds() - before) * 1000.0) - OVERLOAD_TICK_MS;
+        if (lag < 0) lag = 0;
+        atomic_store(&lag_ms, lag);
+
+        int depth = atomic_load(&inflight);
+        int want = 0;
+        if (lag >= OVERLOAD_LAG_MS_2 || depth >= OVERLOAD_INFLIGHT_2) want = 2;
+        else if (lag >= OVERLOAD_LAG_MS_1 || depth >= OVERLOAD_INFLIGHT_1) want = 1;
+
+        int level = atomic_load(&overload_level);
+        if (want > level) {
+            // Raise immediately so shedding starts before the spike spreads to games
+            atomic_store(&overload_level, want);
+            atomic_fetch_add(&level_raises, 1);
+            calm = 0;
+            fprintf(stderr, "overload: level %d (lag %d ms, %d in flight)\n", want, lag, depth);
+        } else if (want < level) {
+            // Step down one level at a time after a sustained calm period
+            if (++calm >= OVERLOAD_RECOVER_TICKS) {
+                atomic_store(&overload_level, level - 1);
+                calm = 0;
+                fprintf(stderr, "overload: level %d\n", level - 1);
+            }
+        } else {
+            calm = 0;
+        }
+    }
+    return NULL;
+}
+
+void admission_init(void) {
+    const char* env = getenv("DAB_RATE_SCALE");
+    if (env && atof(env) > 0) rate_scale = atof(env);
+    pthread_t th;
+    pthread_create(&th, NULL, overload_monitor, NULL);
+    pthread_detach(th);
+}
+
+// Returns 0 if the connection is admitted, -1 at the connection cap, -2 when overloaded
+int admission_connection_open(void) {
+    if (atomic_load(&overload_level) >= 2) {
+        atomic_fetch_add(&conn_rejected_overload, 1);
+        return -2;
+    }
+    if (atomic_fetch_add(&connections, 1) >= MAX_CONNECTIONS) {
+        atomic_fetch_sub(&connections, 1);
+        atomic_fetch_add(&conn_rejected_cap, 1);
+        return -1;
+    }
+    atomic_fetch_add(&conn_accepted, 1);
+    return 0;
+}
+
+// Count a connection inherited from a previous process; never rejected
+void admission_connection_adopt(void) {
+    atomic_fetch_add(&connections, 1);
+}
+
+void admission_connection_close(void) {
+    atomic_fetch_sub(&connections, 1);
+}
+
+// Same as admission_connection_open() for a gateway session, against MAX_SESSIONS
+int admission_session_open(void) {
+    if (atomic_load(&overload_level) >= 2) {
+        atomic_fetch_add(&conn_rejected_overload, 1);
+        return -2;
+    }
+    if (atomic_fetch_add(&sessions, 1) >= MAX_SESSIONS) {
+        atomic_fetch_sub(&sessions, 1);
+        atomic_fetch_add(&conn_rejected_cap, 1);
+        return -1;
+    }
+    atomic_fetch_add(&conn_accepted, 1);
+    return 0;
+}
+
+void admission_session_adopt(void) {
+    atomic_fetch_add(&sessions, 1);
+}
+
+void admission_session_close(void) {
+    atomic_fetch_sub(&sessions, 1);
+}
+
+void admission_conn_init(ConnLimits* limits) {
+    double now = now_seconds();
+    for (int i = 0; i < ADMIT_NUM_CLASSES; i++) {
+        limits->buckets[i].tokens = class_burst[i] * rate_scale;
+        limits->buckets[i].last = now;
+    }
+}
+
+AdmitClass admission_classify(const char* op) {
+    if (strcmp(op, MSG_PLACE_LINE) == 0) return ADMIT_GAME;
+    if (strcmp(op, MSG_LIST_ROOMS) == 0) return ADMIT_LOBBY;
+    if (strcmp(op, MSG_LOGIN) == 0 || strcmp(op, MSG_CREATE_ROOM) == 0 ||
+        strcmp(op, MSG_JOIN_ROOM) == 0) return ADMIT_SESSION;
+    return ADMIT_CONTROL;
+}
+
+AdmitVerdict admission_check(ConnLimits* limits, AdmitClass cls) {
+    int level = atomic_load(&overload_level);
+    if ((level >= 1 && cls == ADMIT_LOBBY) || (level >= 2 && cls == ADMIT_SESSION)) {
+        atomic_fetch_add(&shed[cls], 1);
+        return ADMIT_SHED;
+    }
+
+    TokenBucket* b = &limits->buckets[cls];
+    double now = now_seconds();
+    b->tokens += (now - b->last) * class_rate[cls] * rate_scale;
+    if (b->tokens > class_burst[cls] * rate_scale) b->tokens = class_burst[cls] * rate_scale;
+    b->last = now;
+    if (b->tokens < 1.0) {
+        atomic_fetch_add(&rate_limited[cls], 1);
+        return ADMIT_RATE_LIMITED;
+    }
+    b->tokens -= 1.0;
+    return ADMIT_OK;
+}
+
+void admission_command_begin(void) {
+    atomic_fetch_add(&inflight, 1);
+}
+
+void admission_command_end(void) {
+    atomic_fetch_sub(&inflight, 1);
+}
+
+char* admission_stats_to_json(void) {
+    size_t cap = 1024;
+    char* out = (char*)malloc(cap);
+    size_t off = 0;
+    off += snprintf(out + off, cap - off,
+                    "{\"op\":\"%s\",\"connections\":%d,\"sessions\":%d,\"inflight\":%d,\"overload_level\":%d,\"lag_ms\":%d,",
+                    MSG_STATS, atomic_load(&connections), atomic_load(&sessions), atomic_load(&inflight),
+                    atomic_load(&overload_level), atomic_load(&lag_ms));
+    off += snprintf(out + off, cap - off,
+                    "\"counters\":{\"conn_accepted\":%lu,\"conn_rejected_cap\":%lu,\"conn_rejected_overload\":%lu,\"overload_raises\":%lu",
+                    atomic_load(&conn_accepted), atomic_load(&conn_rejected_cap),
+                    atomic_load(&conn_rejected_overload), atomic_load(&level_raises));
+    for (int i = 0; i < ADMIT_NUM_CLASSES; i++) {
+        off += snprintf(out + off, cap - off, ",\"rate_limited_%s\":%lu,\"shed_%s\":%lu",
+                        class_names[i], atomic_load(&rate_limited[i]),
+                        class_names[i], atomic_load(&shed[i]));
+    }
+    off += snprintf(out + off, cap - off, "}}\n");
+    return out;
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include "archive.h"
+
+// Snapshot of a finished game, copied out of the room so the writer never touches it
+typedef struct {
+    unsigned char rows;
+    unsigned char cols;
+    signed char winner;
+    unsigned char scores[2];
+    unsigned char num_moves;
+    unsigned char moves[MAX_MOVES];
+    char usernames[2][MAX_USERNAME];
+} ArchiveRecord;
+
+static ArchiveRecord queue[ARCHIVE_QUEUE_LEN];
+static int queue_head = 0;
+static int queue_len = 0;
+static unsigned long dropped = 0;
+static int stopping = 0;
+static int archive_fd = -1;
+static int patch_fd = -1;                  // Same file without O_APPEND, for rewriting a partial block's header
+static pthread_t writer_thread;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+// Writer-side block being built (only touched by the writer thread)
+static ArchiveRecord block[ARCHIVE_BLOCK_GAMES];
+static int block_len = 0;
+
+static size_t encode_block(unsigned char* out) {
+    ArchiveBlockHeader hdr;
+    memcpy(hdr.magic, ARCHIVE_MAGIC, 4);
+    hdr.version = ARCHIVE_VERSION;
+    hdr.codec = ARCHIVE_CODEC_RAW;
+    hdr.num_games = (uint32_t)block_len;
+
+    size_t off = sizeof(hdr);
+    for (int i = 0; i < block_len; i++) out[off++] = block[i].rows;
+    for (int i = 0; i < block_len; i++) out[off++] = block[i].cols;
+    for (int i = 0; i < block_len; i++) out[off++] = (unsigned char)block[i].winner;
+    for (int i = 0; i < block_len; i++) out[off++] = block[i].scores[0];
+    for (int i = 0; i < block_len; i++) out[off++] = block[i].scores[1];
+    for (int i = 0; i < block_len; i++) out[off++] = block[i].num_moves;
+    for (int i = 0; i < block_len; i++) {
+        memcpy(out + off, block[i].moves, block[i].num_moves);
+        off += block[i].num_moves;
+    }
+    for (int i = 0; i < block_len; i++) {
+        for (int p = 0; p < 2; p++) {
+            size_t len = strnlen(block[i].usernames[p], MAX_USERNAME - 1);
+            out[off++] = (unsigned char)len;
+            memcpy(out + off, block[i].usernames[p], len);
+            off += len;
+        }
+    }
+
+    hdr.payload_size = (uint32_t)(off - sizeof(hdr));
+    memcpy(out, &hdr, sizeof(hdr));
+    return off;
+}
+
+// Turns the w bytes of a block ending at end into a block of ARCHIVE_CODEC_PARTIAL
+static void mark_partial(off_t end, size_t w) {
+    ArchiveBlockHeader hdr;
+    if (end < 0) {
+        perror("archive seek");
+        return;
+    }
+    if (w < sizeof(hdr)) {
+        // Not even a whole header: only removable while nothing has been appended after it
+        struct stat sb;
+        if (fstat(archive_fd, &sb) == 0 && sb.st_size == end && ftruncate(archive_fd, end - (off_t)w) == 0) return;
+        fprintf(stderr, "archive: partial header at offset %lld, readers stop there\n", (long long)(end - (off_t)w));
+        return;
+    }
+    memcpy(hdr.magic, ARCHIVE_MAGIC, 4);
+    hdr.version = ARCHIVE_VERSION;
+    hdr.codec = ARCHIVE_CODEC_PARTIAL;
+    hdr.num_games = 0;
+    hdr.payload_size = (uint32_t)(w - sizeof(hdr));
+    if (patch_fd < 0 || pwrite(patch_fd, &hdr, sizeof(hdr), end - (off_t)w) != (ssize_t)sizeof(hdr)) perror("archive mark partial");
+}
+
+static void flush_block(void) {
+    if (block_len == 0) return;
+    // Worst case: fixed columns + every move + two full-length names per game
+    static unsigned char buf[sizeof(ArchiveBlockHeader) + ARCHIVE_BLOCK_GAMES * (6 + MAX_MOVES + 2 * MAX_USERNAME)];
+    size_t len = encode_block(buf);
+    // One write per block on an O_APPEND fd keeps blocks whole even if two servers share a file
+    ssize_t w = write(archive_fd, buf, len);
+    if (w < 0) {
+        perror("archive write");
+    } else if (w != (ssize_t)len) {
+        // Short write (e.g. disk full). The file can't be cut back: during a hot restart the
+        // old and new server append to it too, and their blocks may already follow ours.
+        // Instead the partial block's header is rewritten so readers skip exactly what got out.
+        fprintf(stderr, "archive write: short write (%zd of %zu bytes), block dropped\n", w, len);
+        off_t end = lseek(archive_fd, 0, SEEK_CUR);   // After an O_APPEND write: the end of our bytes
+        mark_partial(end, (size_t)w);
+    }
+    block_len = 0;
+}
+
+static void* archive_writer(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (queue_len == 0 && !stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += ARCHIVE_FLUSH_SECS;
+            if (pthread_cond_timedwait(&queue_cond, &queue_lock, &deadline) != 0 && queue_len == 0) {
+                // Idle: don't leave a partial block sitting in memory
+                pthread_mutex_unlock(&queue_lock);
+                flush_block();
+                pthread_mutex_lock(&queue_lock);
+            }
+        }
+        if (queue_len == 0 && stopping) break;
+
+        // Drain whatever is queued into the block without holding the lock for I/O
+        while (queue_len > 0 && block_len < ARCHIVE_BLOCK_GAMES) {
+            block[block_len++] = queue[queue_head];
+            queue_head = (queue_head + 1) % ARCHIVE_QUEUE_LEN;
+            queue_len--;
+        }
+        if (block_len == ARCHIVE_BLOCK_GAMES) {
+            pthread_mutex_unlock(&queue_lock);
+            flush_block();
+            pthread_mutex_lock(&queue_lock);
+        }
+    }
+    pthread_mutex_unlock(&queue_lock);
+    flush_block();
+    return NULL;
+}
+
+int archive_init(const char* path) {
+    archive_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (archive_fd < 0) {
+        perror("archive open");
+        return -1;
+    }
+    patch_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (pthread_create(&writer_thread, NULL, archive_writer, NULL) != 0) {
+        close(archive_fd);
+        if (patch_fd >= 0) close(patch_fd);
+        archive_fd = -1;
+        patch_fd = -1;
+        return -1;
+    }
+    printf("Archiving finished games to %s\n", path);
+    return 0;
+}
+
+void archive_submit(const GameState* game, char usernames[2][MAX_USERNAME]) {
+    if (archive_fd < 0) return;
+    pthread_mutex_lock(&queue_lock);
+    if (queue_len == ARCHIVE_QUEUE_LEN) {
+        // Writer can't keep up; never make the game thread wait on disk
+        dropped++;
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    ArchiveRecord* rec = &queue[(queue_head + queue_len) % ARCHIVE_QUEUE_LEN];
+    rec->rows = (unsigned char)game->rows;
+    rec->cols = (unsigned char)game->cols;
+    rec->winner = (signed char)game->winner;
+    rec->scores[0] = (unsigned char)game->scores[0];
+    rec->scores[1] = (unsigned char)game->scores[1];
+    rec->num_moves = (unsigned char)game->num_moves;
+    memcpy(rec->moves, game->moves, game->num_moves);
+    memcpy(rec->usernames, usernames, sizeof(rec->usernames));
+    queue_len++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void archive_shutdown(void) {
+    if (archive_fd < 0) return;
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(writer_thread, NULL);
+    if (dropped) fprintf(stderr, "archive: dropped %lu games (queue full)\n", dropped);
+    close(archive_fd);
+    if (patch_fd >= 0) close(patch_fd);
+    archive_fd = -1;
+    patch_fd = -1;
+}
@@ -0,0 +1,745 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#include "cluster.h"
+#include "protocol.h"
+
+typedef struct {
+    uint64_t hash;
+    int node;                                  // Index in members[]
+} RingPoint;
+
+static int enabled = 0;
+static atomic_int leaving;
+static atomic_int registered;
+static char self_addr[CLUSTER_ADDR_LEN];
+static char directory_host[CLUSTER_ADDR_LEN];
+static int directory_port;
+static int directory_fd = -1;
+static pthread_mutex_t directory_lock = PTHREAD_MUTEX_INITIALIZER;
+static void (*room_source)(cluster_room_fn fn, void* ctx);
+
+// RELEASEs waiting for directory_thread to send them, so deleting a room never waits
+// on the directory. A byte on release_wake wakes the thread when the queue fills.
+typedef char RoomId[MAX_ROOM_ID];
+static RoomId* release_queue;
+static int release_len;
+static int release_cap;
+static int release_wake[2] = { -1, -1 };
+static pthread_mutex_t release_lock = PTHREAD_MUTEX_INITIALIZER;
+static void unqueue_release(const char* room_id);
+
+// Connections for CLAIM/LOCATE (the registration connection is read by
+// directory_thread). Each carries one request at a time; several let concurrent room
+// commands go out together instead of queueing behind one round trip.
+static int query_fds[CLUSTER_QUERY_CONNS];
+static int query_busy[CLUSTER_QUERY_CONNS];
+static time_t query_retry_at;
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;   // Guards the pool, never held for I/O
+static pthread_cond_t query_idle = PTHREAD_COND_INITIALIZER;
+
+// Other nodes' rooms for LIST_ROOMS, refreshed in the background by peer_refresh_thread
+typedef struct {
+    char node[CLUSTER_ADDR_LEN];
+    int fd;                                    // Kept open between refreshes, -1 if none
+    char* rooms;                               // One JSON object per line; NULL if unreachable
+} PeerRooms;
+
+static PeerRooms peer_cache[CLUSTER_MAX_NODES];
+static int num_peer_cache;
+static pthread_mutex_t peer_lock = PTHREAD_MUTEX_INITIALIZER;
+static void* peer_refresh_thread(void* arg);
+
+// Ring state, replaced whenever the directory sends a new member list
+static pthread_rwlock_t ring_lock = PTHREAD_RWLOCK_INITIALIZER;
+static char members[CLUSTER_MAX_NODES][CLUSTER_ADDR_LEN];
+static int num_members;
+static RingPoint ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static int ring_points;
+
+// FNV-1a, then a 64-bit finalizer so similar keys ("node#1", "node#2") spread out
+uint64_t cluster_hash(const char* key) {
+    uint64_t h = 1469598103934665603ull;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Splits "host:port"; returns 0 on success
+int cluster_parse_addr(const char* addr, char* host, size_t host_cap, int* port) {
+    const char* colon = addr ? strrchr(addr, ':') : NULL;
+    if (!colon || colon == addr || (size_t)(colon - addr) >= host_cap) return -1;
+    memcpy(host, addr, (size_t)(colon - addr));
+    host[colon - addr] = '\0';
+    *port = atoi(colon + 1);
+    return (*port > 0 && *port < 65536) ? 0 : -1;
+}
+
+static int connect_to(const char* host, int port, int timeout_ms) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (timeout_ms > 0) {
+            // Also bounds connect() on Linux
+            struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w <= 0) return -1;
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// read_reply() that gives up at deadline (now_ms() time)
+static int read_reply_until(int fd, char* buf, size_t cap, long deadline) {
+    size_t len = 0;
+    while (len < cap - 1) {
+        long left = deadline - now_ms();
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (left <= 0) return -1;
+        int pr = poll(&pfd, 1, (int)left);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr <= 0) return -1;
+        ssize_t r = read(fd, buf + len, cap - 1 - len);
+        if (r <= 0) return -1;
+        char* nl = memchr(buf + len, '\n', (size_t)r);
+        len += (size_t)r;
+        if (nl) {
+            *nl = '\0';
+            return (int)(nl - buf);
+        }
+    }
+    return -1;
+}
+
+// Reads up to the first newline (dropped); returns the line length or -1
+static int read_reply(int fd, char* buf, size_t cap) {
+    size_t len = 0;
+    while (len < cap - 1) {
+        ssize_t r = read(fd, buf + len, cap - 1 - len);
+        if (r <= 0) return -1;
+        char* nl = memchr(buf + len, '\n', (size_t)r);
+        len += (size_t)r;
+        if (nl) {
+            *nl = '\0';
+            return (int)(nl - buf);
+        }
+    }
+    return -1;
+}
+
+static int compare_points(const void* a, const void* b) {
+    uint64_t ha = ((const RingPoint*)a)->hash, hb = ((const RingPoint*)b)->hash;
+    return ha < hb ? -1 : ha > hb;
+}
+
+// Caller holds ring_lock for writing. A node that is leaving takes itself out so
+// its own placement agrees with what the rest of the cluster will compute.
+static void rebuild_ring(void) {
+    ring_points = 0;
+    for (int n = 0; n < num_members; n++) {
+        if (atomic_load(&leaving) && strcmp(members[n], self_addr) == 0) continue;
+        for (int v = 0; v < CLUSTER_VNODES; v++) {
+            char key[CLUSTER_ADDR_LEN + 16];
+            snprintf(key, sizeof(key), "%.*s#%d", CLUSTER_ADDR_LEN - 1, members[n], v);
+            ring[ring_points].hash = cluster_hash(key);
+            ring[ring_points].node = n;
+            ring_points++;
+        }
+    }
+    qsort(ring, (size_t)ring_points, sizeof(RingPoint), compare_points);
+}
+
+static void apply_members(json_object* jobj) {
+    json_object* no;
+    json_object* eo;
+    if (!json_object_object_get_ex(jobj, "nodes", &no)) return;
+    int epoch = json_object_object_get_ex(jobj, "epoch", &eo) ? json_object_get_int(eo) : 0;
+    pthread_rwlock_wrlock(&ring_lock);
+    num_members = 0;
+    size_t n = json_object_array_length(no);
+    for (size_t i = 0; i < n && num_members < CLUSTER_MAX_NODES; i++) {
+        const char* addr = json_object_get_string(json_object_array_get_idx(no, i));
+        if (!addr || !addr[0]) continue;
+        strncpy(members[num_members], addr, CLUSTER_ADDR_LEN - 1);
+        members[num_members][CLUSTER_ADDR_LEN - 1] = '\0';
+        num_members++;
+    }
+    rebuild_ring();
+    int count = num_members;
+    pthread_rwlock_unlock(&ring_lock);
+    printf("Cluster: %d node(s) (epoch %d)\n", count, epoch);
+}
+
+static void handle_directory_line(const char* line) {
+    json_object* jobj = json_tokener_parse(line);
+    json_object* op;
+    json_object* no;
+    json_object* ro;
+    if (jobj && json_object_object_get_ex(jobj, "op", &op)) {
+        const char* name = json_object_get_string(op);
+        if (strcmp(name, MSG_NODES) == 0) {
+            apply_members(jobj);
+        } else if (strcmp(name, MSG_ROOM_OWNER) == 0 && json_object_object_get_ex(jobj, "node", &no) &&
+                   json_object_object_get_ex(jobj, "room_id", &ro) && strcmp(json_object_get_string(no), self_addr) != 0) {
+            // Reply to a re-claim: another node took the id while we were away
+            fprintf(stderr, "Cluster: room %s is also held by %s\n", json_object_get_string(ro), json_object_get_string(no));
+        }
+    }
+    if (jobj) json_object_put(jobj);
+}
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+} ClaimBatch;
+
+static void add_claim(const char* room_id, void* ctx) {
+    ClaimBatch* b = ctx;
+    char* msg = create_directory_room_message(MSG_CLAIM, room_id, self_addr);
+    size_t n = strlen(msg);
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        while (cap < b->len + n) cap *= 2;
+        char* grown = realloc(b->buf, cap);
+        if (!grown) { free(msg); return; }
+        b->buf = grown;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, msg, n);
+    b->len += n;
+    free(msg);
+}
+
+// Connects and registers, then waits for the directory's first member list, so a
+// hot restart's new process is listed before the old one hangs up. Returns the fd or -1.
+static int directory_register(void) {
+    int fd = connect_to(directory_host, directory_port, CLUSTER_REGISTER_TIMEOUT_MS);
+    if (fd < 0) return -1;
+    char reg[CLUSTER_ADDR_LEN + 64];
+    int n = snprintf(reg, sizeof(reg), "{\"op\":\"%s\",\"node\":\"%s\"}\n", MSG_REGISTER, self_addr);
+    char line[BUFFER_SIZE * 2];
+    size_t len = 0;
+    int ok = write_all(fd, reg, (size_t)n) == 0;
+    // Byte at a time: anything after this line belongs to directory_thread
+    while (ok && len < sizeof(line) - 1) {
+        if (read(fd, line + len, 1) != 1) ok = 0;
+        else if (line[len] == '\n') break;
+        else len++;
+    }
+    if (!ok || len == sizeof(line) - 1) {
+        close(fd);
+        return -1;
+    }
+    line[len] = '\0';
+    // Claim the rooms held here again: a directory that lost us (or restarted) forgot them.
+    // The replies arrive on this connection and are checked by directory_thread.
+    ClaimBatch claims = { NULL, 0, 0 };
+    if (room_source) room_source(add_claim, &claims);
+    if (claims.len > 0 && write_all(fd, claims.buf, claims.len) < 0) {
+        free(claims.buf);
+        close(fd);
+        return -1;
+    }
+    free(claims.buf);
+    struct timeval none = { 0, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+    printf("Cluster: registered %s with directory %s:%d\n", self_addr, directory_host, directory_port);
+    handle_directory_line(line);
+    return fd;
+}
+
+// Empties the RELEASE queue; returns its ids (to free) with their count in *n
+static RoomId* take_releases(int* n) {
+    pthread_mutex_lock(&release_lock);
+    RoomId* ids = release_queue;
+    *n = release_len;
+    release_queue = NULL;
+    release_len = release_cap = 0;
+    pthread_mutex_unlock(&release_lock);
+    return ids;
+}
+
+// Sends every queued RELEASE on fd. Returns -1 if a write failed; the read side
+// then notices the connection is gone.
+static int send_releases(int fd) {
+    int n;
+    RoomId* ids = take_releases(&n);
+    int rc = 0;
+    for (int i = 0; i < n && rc == 0; i++) {
+        char* msg = create_directory_room_message(MSG_RELEASE, ids[i], self_addr);
+        pthread_mutex_lock(&directory_lock);
+        rc = write_all(fd, msg, strlen(msg));
+        pthread_mutex_unlock(&directory_lock);
+        free(msg);
+    }
+    free(ids);
+    return rc;
+}
+
+// Holds the registration open: the directory drops a node, and its room claims, when
+// this connection closes. While the directory is unreachable the last member list
+// stays in use. After cluster_leave() the connection is kept but never re-made.
+// Also the only sender of RELEASEs, which callers just queue.
+static void* directory_thread(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char buf[BUFFER_SIZE * 2];
+    while (1) {
+        if (fd < 0 && atomic_load(&leaving)) break;
+        if (fd < 0) {
+            // A new registration re-claims only the rooms still here; older releases are moot
+            int n;
+            free(take_releases(&n));
+            fd = directory_register();
+        }
+        if (fd < 0) {
+            sleep(CLUSTER_RETRY_SECS);
+            continue;
+        }
+        pthread_mutex_lock(&directory_lock);
+        directory_fd = fd;
+        pthread_mutex_unlock(&directory_lock);
+        int len = 0;
+        int ok = send_releases(fd) == 0;
+        while (ok) {
+            struct pollfd pfd[2] = { { fd, POLLIN, 0 }, { release_wake[0], POLLIN, 0 } };
+            if (poll(pfd, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (pfd[1].revents & POLLIN) {
+                char drain[64];
+                while (read(release_wake[0], drain, sizeof(drain)) > 0) {}
+                if (send_releases(fd) < 0) break;
+            }
+            if (!pfd[0].revents) continue;
+            ssize_t r = read(fd, buf + len, sizeof(buf) - 1 - (size_t)len);
+            if (r <= 0) break;
+            len += (int)r;
+            char* nl;
+            while ((nl = memchr(buf, '\n', (size_t)len)) != NULL) {
+                *nl = '\0';
+                handle_directory_line(buf);
+                int used = (int)(nl - buf) + 1;
+                memmove(buf, buf + used, (size_t)(len - used));
+                len -= used;
+            }
+            if (len == (int)sizeof(buf) - 1) len = 0;   // Oversized line: drop it
+        }
+        pthread_mutex_lock(&directory_lock);
+        close(fd);
+        directory_fd = -1;
+        pthread_mutex_unlock(&directory_lock);
+        fd = -1;
+        if (!atomic_load(&leaving)) {
+            fprintf(stderr, "Cluster: lost directory, keeping the last node list and retrying\n");
+            sleep(CLUSTER_RETRY_SECS);
+        }
+    }
+    return NULL;
+}
+
+void cluster_init(int port) {
+    const char* dir = getenv("DAB_DIRECTORY");
+    if (!dir || !dir[0]) return;
+    if (cluster_parse_addr(dir, directory_host, sizeof(directory_host), &directory_port) < 0) {
+        fprintf(stderr, "Cluster: DAB_DIRECTORY must be host:port, running standalone\n");
+        return;
+    }
+    for (int i = 0; i < CLUSTER_QUERY_CONNS; i++) query_fds[i] = -1;
+    if (pipe2(release_wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+        perror("Cluster: pipe");
+        return;
+    }
+    const char* self = getenv("DAB_NODE_ADDR");
+    if (self && self[0]) {
+        strncpy(self_addr, self, CLUSTER_ADDR_LEN - 1);
+    } else {
+        snprintf(self_addr, sizeof(self_addr), "127.0.0.1:%d", port);
+    }
+    enabled = 1;
+}
+
+// Called once the listener is up, so the directory never lists a node that can't be
+// reached. The first attempt is synchronous; later ones run in the background.
+void cluster_register(void) {
+    if (!enabled || atomic_exchange(&registered, 1)) return;
+    int fd = directory_register();
+    if (fd < 0) fprintf(stderr, "Cluster: directory %s:%d unreachable, retrying\n", directory_host, directory_port);
+    pthread_t th;
+    pthread_create(&th, NULL, directory_thread, (void*)(intptr_t)fd);
+    pthread_detach(th);
+    pthread_create(&th, NULL, peer_refresh_thread, NULL);
+    pthread_detach(th);
+}
+
+int cluster_enabled(void) {
+    return enabled;
+}
+
+void cluster_set_room_source(void (*for_each_room)(cluster_room_fn fn, void* ctx)) {
+    room_source = for_each_room;
+}
+
+// One request/reply with the directory within timeout_ms, waiting for a free pool
+// connection included. Returns the parsed reply or NULL when the directory can't be
+// reached in time; after a failed connect, fails fast until the retry time.
+static json_object* directory_query(const char* request, int timeout_ms) {
+    long deadline = now_ms() + timeout_ms;
+    struct timespec wait_until;
+    clock_gettime(CLOCK_REALTIME, &wait_until);
+    wait_until.tv_sec += timeout_ms / 1000;
+    wait_until.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (wait_until.tv_nsec >= 1000000000) {
+        wait_until.tv_sec++;
+        wait_until.tv_nsec -= 1000000000;
+    }
+    int slot = -1;
+    pthread_mutex_lock(&query_lock);
+    while (slot < 0) {
+        for (int i = 0; i < CLUSTER_QUERY_CONNS && slot < 0; i++) {
+            if (!query_busy[i]) slot = i;
+        }
+        if (slot < 0 && pthread_cond_timedwait(&query_idle, &query_lock, &wait_until) != 0) break;
+    }
+    if (slot >= 0) query_busy[slot] = 1;
+    time_t retry_at = query_retry_at;
+    pthread_mutex_unlock(&query_lock);
+    if (slot < 0) return NULL;
+
+    json_object* reply = NULL;
+    int* fd = &query_fds[slot];
+    for (int attempt = 0; attempt < 2 && !reply; attempt++) {
+        int fresh = 0;
+        long left = deadline - now_ms();
+        if (left <= 0) break;
+        if (*fd < 0) {
+            if (time(NULL) < retry_at) break;
+            *fd = connect_to(directory_host, directory_port, (int)left);
+            if (*fd < 0) {
+                pthread_mutex_lock(&query_lock);
+                query_retry_at = time(NULL) + CLUSTER_RETRY_SECS;
+                pthread_mutex_unlock(&query_lock);
+                break;
+            }
+            fresh = 1;
+        }
+        char line[BUFFER_SIZE];
+        if (write_all(*fd, request, strlen(request)) == 0 && read_reply_until(*fd, line, sizeof(line), deadline) >= 0) {
+            reply = json_tokener_parse(line);
+        } else {
+            // Also after a timeout: a late reply must not answer the next request
+            close(*fd);
+            *fd = -1;
+            if (fresh) break;   // An old connection may just be stale: retry once on a new one
+        }
+    }
+    pthread_mutex_lock(&query_lock);
+    query_busy[slot] = 0;
+    pthread_cond_signal(&query_idle);
+    pthread_mutex_unlock(&query_lock);
+    return reply;
+}
+
+// Holder of room_id according to the directory's ROOM_OWNER reply: 1 with the
+// address in node_out, 0 if nobody holds it, -1 if there was no usable reply
+static int directory_room_owner(const char* op, const char* room_id, const char* node, char* node_out, size_t cap,
+                                int timeout_ms) {
+    char* request = create_directory_room_message(op, room_id, node);
+    json_object* reply = directory_query(request, timeout_ms);
+    free(request);
+    json_object* oo;
+    json_object* no;
+    int rc = -1;
+    if (reply && json_object_object_get_ex(reply, "op", &oo) && strcmp(json_object_get_string(oo), MSG_ROOM_OWNER) == 0 &&
+        json_object_object_get_ex(reply, "node", &no)) {
+        const char* holder = json_object_get_string(no);
+        rc = holder && holder[0] ? 1 : 0;
+        if (rc) {
+            strncpy(node_out, holder, cap - 1);
+            node_out[cap - 1] = '\0';
+        }
+    }
+    if (reply) json_object_put(reply);
+    return rc;
+}
+
+// Takes room_id for this node, cluster-wide. Returns 1 if it is ours now, 0 if
+// another node holds it (address in node_out), -1 if the directory can't say
+// within timeout_ms.
+int cluster_claim_room(const char* room_id, char* node_out, size_t cap, int timeout_ms) {
+    if (!enabled) return 1;
+    unqueue_release(room_id);
+    int rc = directory_room_owner(MSG_CLAIM, room_id, self_addr, node_out, cap, timeout_ms);
+    if (rc <= 0) return -1;
+    return strcmp(node_out, self_addr) == 0 ? 1 : 0;
+}
+
+// Finds the node holding an existing room: 1 with its address in node_out, 0 if no
+// other node holds it, -1 if the directory can't say within timeout_ms
+int cluster_locate_room(const char* room_id, char* node_out, size_t cap, int timeout_ms) {
+    if (!enabled) return 0;
+    int rc = directory_room_owner(MSG_LOCATE, room_id, NULL, node_out, cap, timeout_ms);
+    if (rc == 1 && strcmp(node_out, self_addr) == 0) rc = 0;
+    return rc;
+}
+
+// Gives up a room that was deleted here. Queued for directory_thread, which sends it
+// on the registration connection without a reply: if that connection is down, the
+// directory has dropped our claims anyway.
+void cluster_release_room(const char* room_id) {
+    if (!enabled) return;
+    pthread_mutex_lock(&release_lock);
+    if (release_len == release_cap) {
+        int cap = release_cap ? release_cap * 2 : 16;
+        RoomId* grown = realloc(release_queue, (size_t)cap * sizeof(RoomId));
+        if (!grown) {
+            // The claim then lasts until this node leaves the directory
+            pthread_mutex_unlock(&release_lock);
+            return;
+        }
+        release_queue = grown;
+        release_cap = cap;
+    }
+    strncpy(release_queue[release_len], room_id, MAX_ROOM_ID - 1);
+    release_queue[release_len][MAX_ROOM_ID - 1] = '\0';
+    int wake = release_len++ == 0;
+    pthread_mutex_unlock(&release_lock);
+    if (wake) {
+        char b = 1;
+        ssize_t w = write(release_wake[1], &b, 1);
+        (void)w;
+    }
+}
+
+// A room being created again here must not be released afterwards by a RELEASE
+// still queued from its last life
+static void unqueue_release(const char* room_id) {
+    pthread_mutex_lock(&release_lock);
+    for (int i = 0; i < release_len; ) {
+        if (strncmp(release_queue[i], room_id, MAX_ROOM_ID - 1) == 0) {
+            memcpy(release_queue[i], release_queue[--release_len], MAX_ROOM_ID);
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&release_lock);
+}
+
+// Placement of a new room: 1 if the ring puts room_id here (always, outside cluster
+// mode or before the first member list), else 0 with that node's address in node_out.
+int cluster_owner(const char* room_id, char* node_out, size_t cap) {
+    if (!enabled) return 1;
+    int mine = 1;
+    pthread_rwlock_rdlock(&ring_lock);
+    if (ring_points > 0) {
+        uint64_t h = cluster_hash(room_id);
+        int lo = 0, hi = ring_points;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (ring[mid].hash < h) lo = mid + 1;
+            else hi = mid;
+        }
+        const char* owner = members[ring[lo == ring_points ? 0 : lo].node];
+        if (strcmp(owner, self_addr) != 0) {
+            mine = 0;
+            strncpy(node_out, owner, cap - 1);
+            node_out[cap - 1] = '\0';
+        }
+    }
+    pthread_rwlock_unlock(&ring_lock);
+    return mine;
+}
+
+// Stop taking new rooms: leave the node list and place everything on the other nodes.
+// The registration stays open, so the rooms still being played here keep their ids.
+void cluster_leave(void) {
+    if (!enabled || atomic_exchange(&leaving, 1)) return;
+    static const char leave[] = "{\"op\":\"" MSG_LEAVE "\"}\n";
+    pthread_mutex_lock(&directory_lock);
+    if (directory_fd >= 0) write_all(directory_fd, leave, sizeof(leave) - 1);
+    pthread_mutex_unlock(&directory_lock);
+    pthread_rwlock_wrlock(&ring_lock);
+    rebuild_ring();
+    pthread_rwlock_unlock(&ring_lock);
+    printf("Cluster: left, new rooms go to the other nodes\n");
+}
+
+// Asks one peer for its rooms over the entry's connection, (re)connecting if needed.
+// Returns the rooms as one JSON object per line, "" for none, NULL if the peer
+// can't be reached; a refused request ("Rate limited", overload) keeps the old list.
+static char* fetch_peer_rooms(PeerRooms* p, int* keep) {
+    static const char request[] = "{\"op\":\"" MSG_LIST_ROOMS "\",\"local\":true}\n";
+    char reply[CLUSTER_LIST_BYTES];
+    *keep = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fresh = 0;
+        if (p->fd < 0) {
+            char host[CLUSTER_ADDR_LEN];
+            int port;
+            if (cluster_parse_addr(p->node, host, sizeof(host), &port) < 0) return NULL;
+            p->fd = connect_to(host, port, CLUSTER_PEER_TIMEOUT_MS);
+            if (p->fd < 0) return NULL;
+            fresh = 1;
+        }
+        if (write_all(p->fd, request, sizeof(request) - 1) == 0 && read_reply(p->fd, reply, sizeof(reply)) >= 0) break;
+        close(p->fd);
+        p->fd = -1;
+        if (fresh || attempt) return NULL;   // An old connection may just be stale: retry once on a new one
+    }
+    json_object* jobj = json_tokener_parse(reply);
+    json_object* ro;
+    if (!jobj || !json_object_object_get_ex(jobj, "rooms", &ro)) {
+        if (jobj) json_object_put(jobj);
+        *keep = 1;
+        return NULL;
+    }
+    size_t n = json_object_array_length(ro), len = 0, cap = 256;
+    char* list = malloc(cap);
+    if (!list) { json_object_put(jobj); *keep = 1; return NULL; }
+    list[0] = '\0';
+    for (size_t i = 0; i < n; i++) {
+        const char* room = json_object_to_json_string_ext(json_object_array_get_idx(ro, i), JSON_C_TO_STRING_PLAIN);
+        size_t rlen = strlen(room);
+        if (len + rlen + 2 > cap) {
+            while (len + rlen + 2 > cap) cap *= 2;
+            char* grown = realloc(list, cap);
+            if (!grown) break;
+            list = grown;
+        }
+        memcpy(list + len, room, rlen);
+        len += rlen;
+        list[len++] = '\n';
+        list[len] = '\0';
+    }
+    json_object_put(jobj);
+    return list;
+}
+
+// Keeps peer_cache in step with the member list and refreshes every entry. Only this
+// thread touches the connections; LIST_ROOMS handlers just read the lists.
+static void* peer_refresh_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        char peers[CLUSTER_MAX_NODES][CLUSTER_ADDR_LEN];
+        int num_peers = 0;
+        pthread_rwlock_rdlock(&ring_lock);
+        for (int n = 0; n < num_members; n++) {
+            if (strcmp(members[n], self_addr) != 0) memcpy(peers[num_peers++], members[n], CLUSTER_ADDR_LEN);
+        }
+        pthread_rwlock_unlock(&ring_lock);
+
+        // Drop peers that left, add new ones
+        pthread_mutex_lock(&peer_lock);
+        for (int i = 0; i < num_peer_cache; ) {
+            int listed = 0;
+            for (int n = 0; n < num_peers && !listed; n++) listed = strcmp(peers[n], peer_cache[i].node) == 0;
+            if (listed) { i++; continue; }
+            if (peer_cache[i].fd >= 0) close(peer_cache[i].fd);
+            free(peer_cache[i].rooms);
+            peer_cache[i] = peer_cache[--num_peer_cache];
+        }
+        for (int n = 0; n < num_peers; n++) {
+            int known = 0;
+            for (int i = 0; i < num_peer_cache && !known; i++) known = strcmp(peers[n], peer_cache[i].node) == 0;
+            if (known || num_peer_cache == CLUSTER_MAX_NODES) continue;
+            PeerRooms* p = &peer_cache[num_peer_cache++];
+            memcpy(p->node, peers[n], CLUSTER_ADDR_LEN);
+            p->fd = -1;
+            p->rooms = NULL;
+        }
+        int count = num_peer_cache;
+        pthread_mutex_unlock(&peer_lock);
+
+        // Entries only move while this thread holds peer_lock, so index i stays valid
+        for (int i = 0; i < count; i++) {
+            int keep;
+            char* list = fetch_peer_rooms(&peer_cache[i], &keep);
+            if (keep) continue;
+            pthread_mutex_lock(&peer_lock);
+            free(peer_cache[i].rooms);
+            peer_cache[i].rooms = list;
+            pthread_mutex_unlock(&peer_lock);
+        }
+        usleep(CLUSTER_LIST_REFRESH_MS * 1000);
+    }
+    return NULL;
+}
+
+// Appends the rooms of every other node to a ROOM_LIST array being built in buf.
+// Served from peer_cache, so a slow or dead peer never holds up the caller; the
+// lists are at most CLUSTER_LIST_REFRESH_MS old.
+int cluster_peer_rooms(char* buf, size_t cap, int pos, int* first) {
+    if (!enabled) return pos;
+    pthread_mutex_lock(&peer_lock);
+    for (int i = 0; i < num_peer_cache; i++) {
+        const char* room = peer_cache[i].rooms;
+        while (room && *room) {
+            const char* nl = strchr(room, '\n');
+            size_t len = (size_t)(nl - room);
+            if ((size_t)pos + len + 1 >= cap) break;   // Full: the list is best effort
+            if (!*first) buf[pos++] = ',';
+            *first = 0;
+            memcpy(buf + pos, room, len);
+            pos += (int)len;
+            room = nl + 1;
+        }
+    }
+    pthread_mutex_unlock(&peer_lock);
+    buf[pos] = '\0';
+    return pos;
+}
@@ -24,6 +24,7 @@ void init_game_state(GameState* game, int size) {
     game->current_turn = 0;
     game->game_over = 0;
     game->winner = -1;
+    game->num_moves = 0;
 }
 
 static void append_int_array(char* buf, size_t* off, const int* arr, int len) {
@@ -129,6 +130,7 @@ int place_line(GameState* game, int x, int y, const char* orientation, int playe
         if (y < 0 || y >= grid_rows || x < 0 || x >= box_cols) return -1;
         if (game->horizontal[y][x] == 1) return -2;
         game->horizontal[y][x] = 1;
+        game->moves[game->num_moves++] = MOVE_ENCODE(x, y, 0);
         
         // Check boxes above and below this horizontal line
         if (y > 0) scored += check_box(game, y - 1, x, player);
@@ -139,6 +141,7 @@ int place_line(GameState* game, int x, int y, const char* orientation, int playe
         if (y < 0 || y >= box_rows || x < 0 || x >= grid_cols) return -1;
         if (game->vertical[y][x] == 1) return -2;
         game->vertical[y][x] = 1;
+        game->moves[game->num_moves++] = MOVE_ENCODE(x, y, 1);
         
         // Check boxes left and right of this vertical line
         if (x > 0) scored += check_box(game, y, x - 1, player);
@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "game_batch.h"
+
+// x86-64 only: the SSE4.2 kernel moves 64-bit lanes through general registers
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BATCH_HAVE_X86 1
+#endif
+
+static const char* isa_names[] = { "scalar", "sse4.2", "avx2" };
+
+const char* batch_isa_name(BatchIsa isa) {
+    return isa_names[isa];
+}
+
+static BatchIsa best_isa(void) {
+#ifdef BATCH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return BATCH_ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return BATCH_ISA_SSE42;
+#endif
+    return BATCH_ISA_SCALAR;
+}
+
+void batch_set_isa(GameBatch* batch, BatchIsa isa) {
+    // Never pick something the CPU can't run
+    BatchIsa best = best_isa();
+    batch->isa = isa > best ? best : isa;
+}
+
+int batch_edge_index(const GameBatch* batch, int x, int y, const char* orientation) {
+    int box_cols = batch->cols - 1;
+    if (orientation && strcmp(orientation, ORIENTATION_HORIZONTAL) == 0) {
+        if (y < 0 || y >= batch->rows || x < 0 || x >= box_cols) return -1;
+        return y * box_cols + x;
+    }
+    if (orientation && strcmp(orientation, ORIENTATION_VERTICAL) == 0) {
+        if (y < 0 || y >= batch->rows - 1 || x < 0 || x >= batch->cols) return -1;
+        return batch->rows * box_cols + y * batch->cols + x;
+    }
+    return -1;
+}
+
+void batch_edge_coords(const GameBatch* batch, int edge, int* x, int* y, const char** orientation) {
+    int box_cols = batch->cols - 1;
+    int num_h = batch->rows * box_cols;
+    if (edge < num_h) {
+        *x = edge % box_cols;
+        *y = edge / box_cols;
+        *orientation = ORIENTATION_HORIZONTAL;
+    } else {
+        *x = (edge - num_h) % batch->cols;
+        *y = (edge - num_h) / batch->cols;
+        *orientation = ORIENTATION_VERTICAL;
+    }
+}
+
+GameBatch* batch_create(int size, int count) {
+    GameBatch* b = calloc(1, sizeof(GameBatch));
+    if (!b) return NULL;
+    // Same clamping as init_game_state()
+    GameState proto;
+    init_game_state(&proto, size);
+    b->rows = proto.rows;
+    b->cols = proto.cols;
+    b->count = count;
+    int box_rows = b->rows - 1, box_cols = b->cols - 1;
+    b->num_edges = b->rows * box_cols + box_rows * b->cols;
+    b->num_boxes = box_rows * box_cols;
+    b->all_edges = (b->num_edges == 64) ? ~0ull : (1ull << b->num_edges) - 1;
+    b->all_boxes = (1ull << b->num_boxes) - 1;
+
+    for (int by = 0; by < box_rows; by++) {
+        for (int bx = 0; bx < box_cols; bx++) {
+            int box = by * box_cols + bx;
+            int edges[4] = {
+                batch_edge_index(b, bx, by, ORIENTATION_HORIZONTAL),
+                batch_edge_index(b, bx, by + 1, ORIENTATION_HORIZONTAL),
+                batch_edge_index(b, bx, by, ORIENTATION_VERTICAL),
+                batch_edge_index(b, bx + 1, by, ORIENTATION_VERTICAL)
+            };
+            uint64_t mask = 0;
+            for (int k = 0; k < 4; k++) mask |= 1ull << edges[k];
+            b->box_edges[box] = mask;
+            for (int k = 0; k < 4; k++) {
+                // First box seen for an edge goes in slot a, the second in slot b
+                if (!b->box_edges_a[edges[k]]) {
+                    b->box_edges_a[edges[k]] = mask;
+                    b->box_bit_a[edges[k]] = 1ull << box;
+                } else {
+                    b->box_edges_b[edges[k]] = mask;
+                    b->box_bit_b[edges[k]] = 1ull << box;
+                }
+            }
+        }
+    }
+
+    // Pad to a whole number of 256-bit vectors
+    size_t lanes = ((size_t)count + 3) & ~(size_t)3;
+    b->edges = aligned_alloc(32, lanes * sizeof(uint64_t));
+    b->owners = aligned_alloc(32, lanes * sizeof(uint64_t));
+    if (!b->edges || !b->owners) {
+        batch_free(b);
+        return NULL;
+    }
+    memset(b->edges, 0, lanes * sizeof(uint64_t));
+    memset(b->owners, 0, lanes * sizeof(uint64_t));
+    b->isa = best_isa();
+    return b;
+}
+
+void batch_free(GameBatch* batch) {
+    if (!batch) return;
+    free(batch->edges);
+    free(batch->owners);
+    free(batch);
+}
+
+void batch_load(GameBatch* batch, int lane, const GameState* game) {
+    // game must have the batch's board size
+    uint64_t edges = 0, owners = 0;
+    for (int y = 0; y < batch->rows; y++) {
+        for (int x = 0; x < batch->cols - 1; x++) {
+            if (game->horizontal[y][x]) edges |= 1ull << batch_edge_index(batch, x, y, ORIENTATION_HORIZONTAL);
+        }
+    }
+    for (int y = 0; y < batch->rows - 1; y++) {
+        for (int x = 0; x < batch->cols; x++) {
+            if (game->vertical[y][x]) edges |= 1ull << batch_edge_index(batch, x, y, ORIENTATION_VERTICAL);
+        }
+    }
+    for (int by = 0; by < batch->rows - 1; by++) {
+        for (int bx = 0; bx < batch->cols - 1; bx++) {
+            int box = by * (batch->cols - 1) + bx;
+            if (game->boxes[by][bx] == 0) owners |= 1ull << box;
+            else if (game->boxes[by][bx] == 1) owners |= 1ull << (box + BATCH_P2_SHIFT);
+        }
+    }
+    if (game->current_turn == 1) owners |= BATCH_TURN_BIT;
+    if (game->game_over) owners |= BATCH_OVER_BIT;
+    batch->edges[lane] = edges;
+    batch->owners[lane] = owners;
+}
+
+void batch_store(const GameBatch* batch, int lane, GameState* game) {
+    uint64_t edges = batch->edges[lane], owners = batch->owners[lane];
+    memset(game->horizontal, 0, sizeof(game->horizontal));
+    memset(game->vertical, 0, sizeof(game->vertical));
+    for (int i = 0; i < MAX_GRID_SIZE; i++) {
+        for (int j = 0; j < MAX_GRID_SIZE; j++) game->boxes[i][j] = -1;
+    }
+    game->rows = batch->rows;
+    game->cols = batch->cols;
+    for (int e = 0; e < batch->num_edges; e++) {
+        if (!(edges & (1ull << e))) continue;
+        int x, y;
+        const char* o;
+        batch_edge_coords(batch, e, &x, &y, &o);
+        if (o[0] == 'H') game->horizontal[y][x] = 1;
+        else game->vertical[y][x] = 1;
+    }
+    for (int box = 0; box < batch->num_boxes; box++) {
+        int by = box / (batch->cols - 1), bx = box % (batch->cols - 1);
+        if (owners & (1ull << box)) game->boxes[by][bx] = 0;
+        else if (owners & (1ull << (box + BATCH_P2_SHIFT))) game->boxes[by][bx] = 1;
+    }
+    game->scores[0] = __builtin_popcountll(owners & batch->all_boxes);
+    game->scores[1] = __builtin_popcountll((owners >> BATCH_P2_SHIFT) & batch->all_boxes);
+    game->current_turn = (owners & BATCH_TURN_BIT) ? 1 : 0;
+    game->game_over = (owners & BATCH_OVER_BIT) ? 1 : 0;
+    game->winner = -1;
+    if (game->game_over && game->scores[0] != game->scores[1]) {
+        game->winner = game->scores[0] > game->scores[1] ? 0 : 1;
+    }
+    game->num_moves = 0;
+}
+
+// ---- Scalar kernels (also used for the tail of vector loops) ----
+
+static void apply_scalar(GameBatch* b, int from, int to, const uint8_t* moves, int8_t* results) {
+    for (int i = from; i < to; i++) {
+        uint64_t own = b->owners[i];
+        unsigned m = moves[i];
+        if ((own & BATCH_OVER_BIT) || m >= (unsigned)b->num_edges) { results[i] = -1; continue; }
+        uint64_t bit = 1ull << m;
+        uint64_t e = b->edges[i];
+        if (e & bit) { results[i] = -2; continue; }
+        e |= bit;
+        uint64_t gained = 0;
+        if (b->box_edges_a[m] && (e & b->box_edges_a[m]) == b->box_edges_a[m]) gained |= b->box_bit_a[m];
+        if (b->box_edges_b[m] && (e & b->box_edges_b[m]) == b->box_edges_b[m]) gained |= b->box_bit_b[m];
+        gained &= ~(own | (own >> BATCH_P2_SHIFT));
+        own |= (own & BATCH_TURN_BIT) ? gained << BATCH_P2_SHIFT : gained;
+        if (!gained) own ^= BATCH_TURN_BIT;
+        if (((own | (own >> BATCH_P2_SHIFT)) & b->all_boxes) == b->all_boxes) own |= BATCH_OVER_BIT;
+        b->edges[i] = e;
+        b->owners[i] = own;
+        results[i] = 0;
+    }
+}
+
+static void legal_scalar(const GameBatch* b, int from, int to, uint64_t* legal) {
+    for (int i = from; i < to; i++) {
+        legal[i] = (b->owners[i] & BATCH_OVER_BIT) ? 0 : (~b->edges[i] & b->all_edges);
+    }
+}
+
+static void completed_scalar(const GameBatch* b, int from, int to, uint32_t* completed) {
+    for (int i = from; i < to; i++) {
+        uint32_t done = 0;
+        for (int box = 0; box < b->num_boxes; box++) {
+            if ((b->edges[i] & b->box_edges[box]) == b->box_edges[box]) done |= 1u << box;
+        }
+        completed[i] = done;
+    }
+}
+
+#ifdef BATCH_HAVE_X86
+
+// ---- AVX2: 4 lanes per step ----
+
+__attribute__((target("avx2")))
+static void apply_avx2(GameBatch* b, const uint8_t* moves, int8_t* results) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i num_edges = _mm256_set1_epi64x(b->num_edges);
+    const __m256i index_mask = _mm256_set1_epi64x(BATCH_MAX_EDGES - 1);
+    const __m256i turn_bit = _mm256_set1_epi64x((long long)BATCH_TURN_BIT);
+    const __m256i over_bit = _mm256_set1_epi64x((long long)BATCH_OVER_BIT);
+    const __m256i all_boxes = _mm256_set1_epi64x((long long)b->all_boxes);
+    const __m256i err_invalid = _mm256_set1_epi64x(-1);
+    const __m256i err_placed = _mm256_set1_epi64x(-2);
+    int i = 0;
+    for (; i + 4 <= b->count; i += 4) {
+        int32_t packed;
+        memcpy(&packed, moves + i, sizeof(packed));
+        __m256i m = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(b->edges + i));
+        __m256i own = _mm256_loadu_si256((const __m256i*)(b->owners + i));
+
+        // Bit 63 set <=> signed value below zero
+        __m256i invalid = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpgt_epi64(num_edges, m), ones),
+                                          _mm256_cmpgt_epi64(zero, own));
+        __m256i bit = _mm256_sllv_epi64(one, m);
+        __m256i placed = _mm256_andnot_si256(invalid, _mm256_cmpeq_epi64(_mm256_and_si256(e, bit), bit));
+        __m256i ok = _mm256_xor_si256(_mm256_or_si256(invalid, placed), ones);
+        e = _mm256_or_si256(e, _mm256_and_si256(bit, ok));
+
+        __m256i mi = _mm256_and_si256(m, index_mask);
+        __m256i ma = _mm256_i64gather_epi64((const long long*)b->box_edges_a, mi, 8);
+        __m256i mb = _mm256_i64gather_epi64((const long long*)b->box_edges_b, mi, 8);
+        __m256i ba = _mm256_i64gather_epi64((const long long*)b->box_bit_a, mi, 8);
+        __m256i bb = _mm256_i64gather_epi64((const long long*)b->box_bit_b, mi, 8);
+        __m256i done_a = _mm256_andnot_si256(_mm256_cmpeq_epi64(ma, zero), _mm256_cmpeq_epi64(_mm256_and_si256(e, ma), ma));
+        __m256i done_b = _mm256_andnot_si256(_mm256_cmpeq_epi64(mb, zero), _mm256_cmpeq_epi64(_mm256_and_si256(e, mb), mb));
+        __m256i gained = _mm256_or_si256(_mm256_and_si256(done_a, ba), _mm256_and_si256(done_b, bb));
+        gained = _mm256_andnot_si256(_mm256_or_si256(own, _mm256_srli_epi64(own, BATCH_P2_SHIFT)), gained);
+        gained = _mm256_and_si256(gained, ok);
+
+        __m256i p2 = _mm256_cmpeq_epi64(_mm256_and_si256(own, turn_bit), turn_bit);
+        own = _mm256_or_si256(own, _mm256_blendv_epi8(gained, _mm256_slli_epi64(gained, BATCH_P2_SHIFT), p2));
+        __m256i pass = _mm256_and_si256(ok, _mm256_cmpeq_epi64(gained, zero));
+        own = _mm256_xor_si256(own, _mm256_and_si256(pass, turn_bit));
+        __m256i filled = _mm256_and_si256(_mm256_or_si256(own, _mm256_srli_epi64(own, BATCH_P2_SHIFT)), all_boxes);
+        __m256i over = _mm256_and_si256(ok, _mm256_cmpeq_epi64(filled, all_boxes));
+        own = _mm256_or_si256(own, _mm256_and_si256(over, over_bit));
+
+        _mm256_storeu_si256((__m256i*)(b->edges + i), e);
+        _mm256_storeu_si256((__m256i*)(b->owners + i), own);
+        __m256i res = _mm256_or_si256(_mm256_and_si256(invalid, err_invalid), _mm256_and_si256(placed, err_placed));
+        int64_t r[4];
+        _mm256_storeu_si256((__m256i*)r, res);
+        for (int k = 0; k < 4; k++) results[i + k] = (int8_t)r[k];
+    }
+    apply_scalar(b, i, b->count, moves, results);
+}
+
+__attribute__((target("avx2")))
+static void legal_avx2(const GameBatch* b, uint64_t* legal) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i all_edges = _mm256_set1_epi64x((long long)b->all_edges);
+    int i = 0;
+    for (; i + 4 <= b->count; i += 4) {
+        __m256i e = _mm256_loadu_si256((const __m256i*)(b->edges + i));
+        __m256i own = _mm256_loadu_si256((const __m256i*)(b->owners + i));
+        __m256i open = _mm256_andnot_si256(e, all_edges);
+        _mm256_storeu_si256((__m256i*)(legal + i), _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, own), open));
+    }
+    legal_scalar(b, i, b->count, legal);
+}
+
+__attribute__((target("avx2")))
+static void completed_avx2(const GameBatch* b, uint32_t* completed) {
+    int i = 0;
+    for (; i + 4 <= b->count; i += 4) {
+        __m256i e = _mm256_loadu_si256((const __m256i*)(b->edges + i));
+        __m256i done = _mm256_setzero_si256();
+        for (int box = 0; box < b->num_boxes; box++) {
+            __m256i mask = _mm256_set1_epi64x((long long)b->box_edges[box]);
+            __m256i full = _mm256_cmpeq_epi64(_mm256_and_si256(e, mask), mask);
+            done = _mm256_or_si256(done, _mm256_and_si256(full, _mm256_set1_epi64x(1ll << box)));
+        }
+        int64_t r[4];
+        _mm256_storeu_si256((__m256i*)r, done);
+        for (int k = 0; k < 4; k++) completed[i + k] = (uint32_t)r[k];
+    }
+    completed_scalar(b, i, b->count, completed);
+}
+
+// ---- SSE4.2: 2 lanes per step (no variable shifts or gathers, so tables are loaded per lane) ----
+
+__attribute__((target("sse4.2")))
+static void apply_sse42(GameBatch* b, const uint8_t* moves, int8_t* results) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi64x(-1);
+    const __m128i num_edges = _mm_set1_epi64x(b->num_edges);
+    const __m128i turn_bit = _mm_set1_epi64x((long long)BATCH_TURN_BIT);
+    const __m128i over_bit = _mm_set1_epi64x((long long)BATCH_OVER_BIT);
+    const __m128i all_boxes = _mm_set1_epi64x((long long)b->all_boxes);
+    const __m128i err_invalid = _mm_set1_epi64x(-1);
+    const __m128i err_placed = _mm_set1_epi64x(-2);
+    int i = 0;
+    for (; i + 2 <= b->count; i += 2) {
+        unsigned m0 = moves[i], m1 = moves[i + 1];
+        unsigned i0 = m0 & (BATCH_MAX_EDGES - 1), i1 = m1 & (BATCH_MAX_EDGES - 1);
+        __m128i m = _mm_set_epi64x(m1, m0);
+        __m128i e = _mm_loadu_si128((const __m128i*)(b->edges + i));
+        __m128i own = _mm_loadu_si128((const __m128i*)(b->owners + i));
+
+        __m128i invalid = _mm_or_si128(_mm_xor_si128(_mm_cmpgt_epi64(num_edges, m), ones),
+                                       _mm_cmpgt_epi64(zero, own));
+        __m128i bit = _mm_set_epi64x((long long)(1ull << i1), (long long)(1ull << i0));
+        __m128i placed = _mm_andnot_si128(invalid, _mm_cmpeq_epi64(_mm_and_si128(e, bit), bit));
+        __m128i ok = _mm_xor_si128(_mm_or_si128(invalid, placed), ones);
+        e = _mm_or_si128(e, _mm_and_si128(bit, ok));
+
+        __m128i ma = _mm_set_epi64x((long long)b->box_edges_a[i1], (long long)b->box_edges_a[i0]);
+        __m128i mb = _mm_set_epi64x((long long)b->box_edges_b[i1], (long long)b->box_edges_b[i0]);
+        __m128i ba = _mm_set_epi64x((long long)b->box_bit_a[i1], (long long)b->box_bit_a[i0]);
+        __m128i bb = _mm_set_epi64x((long long)b->box_bit_b[i1], (long long)b->box_bit_b[i0]);
+        __m128i done_a = _mm_andnot_si128(_mm_cmpeq_epi64(ma, zero), _mm_cmpeq_epi64(_mm_and_si128(e, ma), ma));
+        __m128i done_b = _mm_andnot_si128(_mm_cmpeq_epi64(mb, zero), _mm_cmpeq_epi64(_mm_and_si128(e, mb), mb));
+        __m128i gained = _mm_or_si128(_mm_and_si128(done_a, ba), _mm_and_si128(done_b, bb));
+        gained = _mm_andnot_si128(_mm_or_si128(own, _mm_srli_epi64(own, BATCH_P2_SHIFT)), gained);
+        gained = _mm_and_si128(gained, ok);
+
+        __m128i p2 = _mm_cmpeq_epi64(_mm_and_si128(own, turn_bit), turn_bit);
+        own = _mm_or_si128(own, _mm_blendv_epi8(gained, _mm_slli_epi64(gained, BATCH_P2_SHIFT), p2));
+        __m128i pass = _mm_and_si128(ok, _mm_cmpeq_epi64(gained, zero));
+        own = _mm_xor_si128(own, _mm_and_si128(pass, turn_bit));
+        __m128i filled = _mm_and_si128(_mm_or_si128(own, _mm_srli_epi64(own, BATCH_P2_SHIFT)), all_boxes);
+        __m128i over = _mm_and_si128(ok, _mm_cmpeq_epi64(filled, all_boxes));
+        own = _mm_or_si128(own, _mm_and_si128(over, over_bit));
+
+        _mm_storeu_si128((__m128i*)(b->edges + i), e);
+        _mm_storeu_si128((__m128i*)(b->owners + i), own);
+        __m128i res = _mm_or_si128(_mm_and_si128(invalid, err_invalid), _mm_and_si128(placed, err_placed));
+        results[i] = (int8_t)_mm_cvtsi128_si64(res);
+        results[i + 1] = (int8_t)_mm_extract_epi64(res, 1);
+    }
+    apply_scalar(b, i, b->count, moves, results);
+}
+
+#endif // BATCH_HAVE_X86
+
+// ---- Dispatch ----
+
+void batch_apply_moves(GameBatch* batch, const uint8_t* moves, int8_t* results) {
+#ifdef BATCH_HAVE_X86
+    if (batch->isa == BATCH_ISA_AVX2) { apply_avx2(batch, moves, results); return; }
+    if (batch->isa == BATCH_ISA_SSE42) { apply_sse42(batch, moves, results); return; }
+#endif
+    apply_scalar(batch, 0, batch->count, moves, results);
+}
+
+void batch_legal_moves(const GameBatch* batch, uint64_t* legal) {
+#ifdef BATCH_HAVE_X86
+    if (batch->isa == BATCH_ISA_AVX2) { legal_avx2(batch, legal); return; }
+#endif
+    legal_scalar(batch, 0, batch->count, legal);
+}
+
+void batch_completed_boxes(const GameBatch* batch, uint32_t* completed) {
+#ifdef BATCH_HAVE_X86
+    if (batch->isa == BATCH_ISA_AVX2) { completed_avx2(batch, completed); return; }
+#endif
+    completed_scalar(batch, 0, batch->count, completed);
+}
+
+void batch_scores(const GameBatch* batch, uint8_t* scores0, uint8_t* scores1) {
+    for (int i = 0; i < batch->count; i++) {
+        uint64_t own = batch->owners[i];
+        scores0[i] = (uint8_t)__builtin_popcountll(own & batch->all_boxes);
+        scores1[i] = (uint8_t)__builtin_popcountll((own >> BATCH_P2_SHIFT) & batch->all_boxes);
+    }
+}
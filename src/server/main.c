@@ -1,14 +1,55 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include "server.h"
+#include "archive.h"
+#include "admission.h"
+#include "trace.h"
+#include "cluster.h"
 
-static volatile int running = 1;
-static void handle_sigint(int sig) { (void)sig; running = 0; }
+// SIGINT/SIGTERM: draining shutdown (twice to close immediately). SIGUSR2: hot restart.
+// SIGUSR1: dump the flight recorder.
+static void handle_signal(int sig) {
+    if (sig == SIGUSR1) trace_request_dump();
+    else server_signal_stop(sig == SIGUSR2 ? SERVER_STOP_RESTART : SERVER_STOP_DRAIN);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-int main(void) {
-    signal(SIGINT, handle_sigint);
+    const char* archive_path = getenv("DAB_ARCHIVE");
+    archive_init(archive_path ? archive_path : ARCHIVE_DEFAULT_PATH);
+    trace_init();
     init_server();
+    admission_init();
+    server_set_exec_path(argv[0], argv);
+    // DAB_PORT: listen port, so several nodes can run on one host
+    const char* port_env = getenv("DAB_PORT");
+    int port = port_env ? atoi(port_env) : SERVER_PORT;
+    server_set_port(port);
+    cluster_init(port);
+
+    const char* handoff = getenv(HANDOFF_ENV);
+    if (handoff) {
+        int handoff_fd = atoi(handoff);
+        unsetenv(HANDOFF_ENV);
+        if (resume_from_handoff(handoff_fd) < 0) {
+            archive_shutdown();
+            return 1;
+        }
+    }
     start_server();
+    archive_shutdown();
     return 0;
 }
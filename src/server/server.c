@@ -1,24 +1,97 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include "server.h"
 #include "protocol.h"
+#include "archive.h"
+#include "admission.h"
+#include "trace.h"
+#include "cluster.h"
 
-static Room rooms[MAX_ROOMS];
+static Room* rooms;                        // max_rooms slots
+static int max_rooms = MAX_ROOMS;
+static pthread_mutex_t rooms_lock = PTHREAD_MUTEX_INITIALIZER;   // Taking and freeing slots
 static int server_fd = -1;
+static int listen_port = SERVER_PORT;
+
+static Client clients[MAX_CONNECTIONS];
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int active_handlers;
+static volatile sig_atomic_t stop_mode = SERVER_STOP_NONE;
+static volatile sig_atomic_t stop_pending = SERVER_STOP_NONE;   // Drain asked for during a hot restart
+static char exec_path[PATH_MAX];
+static char** exec_argv;
+
+// Hot restart handoff: a header (with the listener fd attached), then one
+// packet per Room, one packet per Client with its socket attached, and one
+// packet per gateway session (followed by its held-back frames, if any).
+#define HANDOFF_MAGIC "DABH"
+#define HANDOFF_VERSION 3
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t room_size;                    // sizeof(Room) / sizeof(Client) / sizeof(MuxSession)
+    uint32_t client_size;                  // must match: a layout change needs a full restart
+    uint32_t session_size;
+    uint32_t num_rooms;
+    uint32_t num_clients;
+    uint32_t num_sessions;
+} HandoffHeader;
+
+typedef struct {
+    uint32_t slot;                         // Index in clients[]
+    Client client;
+} HandoffClient;
+
+// Gateway sessions, allocated MUX_SESSION_CHUNK slots at a time as links open them.
+// Chunks are never freed, so a session's address and handle stay valid.
+#define SESSION_CHUNKS (MAX_SESSIONS / MUX_SESSION_CHUNK)
+static _Atomic(MuxSession*) session_chunks[SESSION_CHUNKS];
+static int session_free[MAX_SESSIONS];     // Free slots, lowest on top
+static int session_free_len = 0;
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Gateway links: the client slot of each link, and each link's session slots by
+// id. A link's sid map is grown and read only by that link's handler.
+static int link_clients[MUX_MAX_LINKS];
+static int* link_sessions[MUX_MAX_LINKS];
+static int link_sids_cap[MUX_MAX_LINKS];
+static pthread_mutex_t link_locks[MUX_MAX_LINKS];
+
+// Room of the command this thread is running, tags the QUEUED/WRITTEN trace events
+static _Thread_local const char* trace_room;
 
 static void set_nonblocking(int fd) { (void)fd; }
 static void send_error(int fd, const char* msg);
+static void mux_send(int handle, const char* message);
+static void each_local_room(cluster_room_fn fn, void* ctx);
 
 void send_message(int socket, const char* message) {
     if (!message) return;
     size_t len = strlen(message);
-    ssize_t w = write(socket, message, len);
-    (void)w;
+    trace_event(TRACE_QUEUED, socket, trace_room);
+    if (socket >= MUX_SESSION_BASE) {
+        mux_send(socket, message);
+    } else {
+        ssize_t w = write(socket, message, len);
+        (void)w;
+    }
+    trace_event(TRACE_WRITTEN, socket, trace_room);
 }
 
 void broadcast_to_room(const char* room_id, const char* message, int exclude_fd) {
@@ -34,7 +107,7 @@ void broadcast_to_room(const char* room_id, const char* message, int exclude_fd)
 }
 
 Room* find_room(const char* room_id) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
+    for (int i = 0; i < max_rooms; i++) {
         if (rooms[i].room_id[0] && strcmp(rooms[i].room_id, room_id) == 0) {
             return &rooms[i];
         }
@@ -42,133 +115,673 @@ Room* find_room(const char* room_id) {
     return NULL;
 }
 
+// CREATE_ROOMs between their duplicate check and create_room(), so a second one for
+// the same id on this node is refused rather than claimed at the directory again
+typedef struct PendingRoom {
+    const char* room_id;
+    struct PendingRoom* next;
+} PendingRoom;
+static PendingRoom* pending_rooms;         // Guarded by rooms_lock
+
+// Reserves room_id for one CREATE_ROOM; 0 if a room or another CREATE_ROOM has it
+static int reserve_room_id(PendingRoom* p, const char* room_id) {
+    int free_id = 1;
+    pthread_mutex_lock(&rooms_lock);
+    if (find_room(room_id)) free_id = 0;
+    for (PendingRoom* q = pending_rooms; q && free_id; q = q->next) free_id = strcmp(q->room_id, room_id) != 0;
+    if (free_id) {
+        p->room_id = room_id;
+        p->next = pending_rooms;
+        pending_rooms = p;
+    }
+    pthread_mutex_unlock(&rooms_lock);
+    return free_id;
+}
+
+static void unreserve_room_id(PendingRoom* p) {
+    pthread_mutex_lock(&rooms_lock);
+    PendingRoom** q = &pending_rooms;
+    while (*q != p) q = &(*q)->next;
+    *q = p->next;
+    pthread_mutex_unlock(&rooms_lock);
+}
+
 Room* create_room(const char* room_id, int creator_fd, const char* username, int grid_size) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].room_id[0] == '\0') {
-            strncpy(rooms[i].room_id, room_id, MAX_ROOM_ID-1);
-            rooms[i].room_id[MAX_ROOM_ID-1] = '\0';
-            rooms[i].players[0] = creator_fd;
-            rooms[i].players[1] = -1;
-            strncpy(rooms[i].usernames[0], username ? username : "", MAX_USERNAME-1);
-            rooms[i].usernames[0][MAX_USERNAME-1] = '\0';
-            rooms[i].usernames[1][0] = '\0';
-            rooms[i].player_count = 1;
-            rooms[i].game_started = 0;
-            rooms[i].grid_size = grid_size;
-            pthread_mutex_init(&rooms[i].lock, NULL);
-            init_game_state(&rooms[i].game, grid_size);
-            return &rooms[i];
-        }
+    Room* r = NULL;
+    pthread_mutex_lock(&rooms_lock);
+    for (int i = 0; i < max_rooms && !r; i++) {
+        if (rooms[i].room_id[0] == '\0') r = &rooms[i];
     }
-    return NULL;
+    if (r) {
+        r->players[0] = creator_fd;
+        r->players[1] = -1;
+        strncpy(r->usernames[0], username ? username : "", MAX_USERNAME-1);
+        r->usernames[0][MAX_USERNAME-1] = '\0';
+        r->usernames[1][0] = '\0';
+        r->player_count = 1;
+        r->game_started = 0;
+        r->grid_size = grid_size;
+        pthread_mutex_init(&r->lock, NULL);
+        init_game_state(&r->game, grid_size);
+        // The id goes in last: find_room() callers without rooms_lock see a whole room or none
+        atomic_thread_fence(memory_order_release);
+        strncpy(r->room_id, room_id, MAX_ROOM_ID-1);
+        r->room_id[MAX_ROOM_ID-1] = '\0';
+    }
+    pthread_mutex_unlock(&rooms_lock);
+    return r;
 }
 
 int join_room(const char* room_id, int client_fd, const char* username) {
+    int rc = 0;
+    pthread_mutex_lock(&rooms_lock);
     Room* r = find_room(room_id);
-    if (!r) return -1;
-    if (r->players[0] == client_fd) return -3;
-    if (r->player_count >= 2 || r->players[1] != -1) return -2;
-    r->players[1] = client_fd;
-    strncpy(r->usernames[1], username ? username : "", MAX_USERNAME-1);
-    r->usernames[1][MAX_USERNAME-1] = '\0';
-    r->player_count = 2;
-    r->game_started = 1;
+    if (!r) rc = -1;
+    else if (r->players[0] == client_fd) rc = -3;
+    else if (r->player_count >= 2 || r->players[1] != -1) rc = -2;
+    else {
+        r->players[1] = client_fd;
+        strncpy(r->usernames[1], username ? username : "", MAX_USERNAME-1);
+        r->usernames[1][MAX_USERNAME-1] = '\0';
+        r->player_count = 2;
+        r->game_started = 1;
+    }
+    pthread_mutex_unlock(&rooms_lock);
+    return rc;
+}
+
+// Takes fd out of the next room it is in, from slot *next on, and frees the room if it
+// ends. Caller holds rooms_lock. Returns 0 when there is no such room; otherwise the
+// freed room's id is in released ("" if it lives on) and the player to tell in *notify_fd.
+static int leave_next_room(int fd, int* next, char* released, int* notify_fd) {
+    released[0] = '\0';
+    *notify_fd = -1;
+    for (int i = *next; i < max_rooms; i++) {
+        if (rooms[i].room_id[0] == '\0') continue;
+        int p = rooms[i].players[0] == fd ? 0 : rooms[i].players[1] == fd ? 1 : -1;
+        if (p < 0) continue;
+        *next = i + 1;
+        rooms[i].players[p] = -1;
+        rooms[i].usernames[p][0] = '\0';
+        rooms[i].player_count--;
+        // User said: "when the one of the palyers exited the room ... delete the room",
+        // so a started game closes when either player leaves
+        int other_fd = rooms[i].players[1 - p];
+        if (rooms[i].player_count > 0 && !(rooms[i].game_started && other_fd != -1)) return 1;
+        if (rooms[i].player_count > 0) *notify_fd = other_fd;
+        memcpy(released, rooms[i].room_id, MAX_ROOM_ID);
+        rooms[i].room_id[0] = '\0';
+        rooms[i].player_count = 0;
+        rooms[i].players[0] = -1;
+        rooms[i].players[1] = -1;
+        rooms[i].game_started = 0;
+        pthread_mutex_destroy(&rooms[i].lock);
+        return 1;
+    }
+    *next = max_rooms;
     return 0;
 }
 
 void cleanup_client(int fd) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].room_id[0] != '\0') {
-            int found = 0;
-            if (rooms[i].players[0] == fd) {
-                rooms[i].players[0] = -1;
-                rooms[i].usernames[0][0] = '\0';
-                found = 1;
-            } else if (rooms[i].players[1] == fd) {
-                rooms[i].players[1] = -1;
-                rooms[i].usernames[1][0] = '\0';
-                found = 1;
-            }
-            
-            if (found) {
-                rooms[i].player_count--;
-                if (rooms[i].player_count <= 0) {
-                    // Room empty, delete it
-                    rooms[i].room_id[0] = '\0';
-                    rooms[i].game_started = 0;
-                    pthread_mutex_destroy(&rooms[i].lock);
-                } else {
-                    // Notify other player or end game
-                    // For now, if game started and one leaves, maybe end game?
-                    // Or just let them wait?
-                    // User said: "when the one of the palyers exited the room ... delete the room"
-                    // So if game started, we should probably close the room.
-                    if (rooms[i].game_started) {
-                        // Find the other player
-                        int other_fd = (rooms[i].players[0] != -1) ? rooms[i].players[0] : rooms[i].players[1];
-                        if (other_fd != -1) {
-                            send_error(other_fd, "Opponent disconnected. Room closed.");
-                            // Force room close
-                            rooms[i].room_id[0] = '\0';
-                            rooms[i].player_count = 0;
-                            rooms[i].players[0] = -1;
-                            rooms[i].players[1] = -1;
-                            rooms[i].game_started = 0;
-                            pthread_mutex_destroy(&rooms[i].lock);
-                        }
-                    }
-                }
-            }
-        }
+    // Both players of a room can leave at once; without the lock the second could
+    // delete a new room that took the slot the first just freed. Nothing that can
+    // block (a write to a player or the directory) happens while it is held.
+    int next = 0;
+    while (1) {
+        char released[MAX_ROOM_ID];
+        int notify_fd;
+        pthread_mutex_lock(&rooms_lock);
+        int found = leave_next_room(fd, &next, released, &notify_fd);
+        pthread_mutex_unlock(&rooms_lock);
+        if (!found) break;
+        if (notify_fd != -1) send_error(notify_fd, "Opponent disconnected. Room closed.");
+        if (released[0]) cluster_release_room(released);
     }
 }
 
 void* handle_client(void* arg);
 
 void init_server(void) {
-    memset(rooms, 0, sizeof(rooms));
-    for (int i = 0; i < MAX_ROOMS; i++) {
+    // DAB_MAX_ROOMS: room slots on this node (benchmarks and big nodes raise it)
+    const char* env = getenv("DAB_MAX_ROOMS");
+    if (env && atoi(env) > 0) max_rooms = atoi(env) < MAX_ROOMS_LIMIT ? atoi(env) : MAX_ROOMS_LIMIT;
+    rooms = calloc((size_t)max_rooms, sizeof(Room));
+    if (!rooms) {
+        perror("rooms");
+        exit(1);
+    }
+    for (int i = 0; i < max_rooms; i++) {
         rooms[i].players[0] = -1;
         rooms[i].players[1] = -1;
     }
+    memset(clients, 0, sizeof(clients));
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        clients[i].session.socket = -1;
+    }
+    for (int l = 0; l < MUX_MAX_LINKS; l++) {
+        link_clients[l] = -1;
+        pthread_mutex_init(&link_locks[l], NULL);
+    }
+    cluster_set_room_source(each_local_room);
 }
 
-void start_server(void) {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(SERVER_PORT);
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        exit(1);
+void server_signal_stop(int mode) {
+    // Called from signal handlers: only touches stop_mode and stop_pending
+    if (mode == SERVER_STOP_DRAIN && (stop_mode == SERVER_STOP_DRAIN || stop_pending == SERVER_STOP_DRAIN)) {
+        mode = SERVER_STOP_CLOSE; // second Ctrl-C
     }
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
-        perror("listen");
-        exit(1);
+    // A drain can't interrupt a handoff; it is kept for whichever process ends up serving
+    if (mode == SERVER_STOP_DRAIN && stop_mode == SERVER_STOP_RESTART) stop_pending = mode;
+    else if (stop_mode == SERVER_STOP_NONE || mode == SERVER_STOP_CLOSE) stop_mode = mode;
+}
+
+void server_set_port(int port) {
+    listen_port = port;
+}
+
+void server_set_exec_path(const char* path, char** argv) {
+    // Resolve now: a deploy replaces the file at this path with the new binary
+    if (!realpath(path, exec_path)) {
+        strncpy(exec_path, "/proc/self/exe", sizeof(exec_path) - 1);
+    }
+    exec_argv = argv;
+}
+
+static Client* alloc_client(int fd) {
+    Client* c = NULL;
+    pthread_mutex_lock(&clients_lock);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (clients[i].session.socket == -1) {
+            c = &clients[i];
+            memset(c, 0, sizeof(*c));
+            c->session.socket = fd;
+            c->mux_link = -1;
+            admission_conn_init(&c->session.limits);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return c;
+}
+
+static void free_client(Client* c) {
+    pthread_mutex_lock(&clients_lock);
+    c->session.socket = -1;
+    pthread_mutex_unlock(&clients_lock);
+}
+
+static MuxSession* session_slot(int slot) {
+    if (slot < 0 || slot >= MAX_SESSIONS) return NULL;
+    MuxSession* chunk = atomic_load(&session_chunks[slot / MUX_SESSION_CHUNK]);
+    return chunk ? &chunk[slot % MUX_SESSION_CHUNK] : NULL;
+}
+
+static MuxSession* session_for(int handle) {
+    return session_slot(handle - MUX_SESSION_BASE);
+}
+
+// Caller holds sessions_lock (or is resuming, before any thread runs).
+// A new chunk's slots are free but not yet on the free list.
+static MuxSession* session_chunk(int c) {
+    MuxSession* chunk = atomic_load(&session_chunks[c]);
+    if (chunk) return chunk;
+    chunk = calloc(MUX_SESSION_CHUNK, sizeof(MuxSession));
+    if (!chunk) return NULL;
+    for (int i = 0; i < MUX_SESSION_CHUNK; i++) chunk[i].session.socket = -1;
+    atomic_store(&session_chunks[c], chunk);
+    return chunk;
+}
+
+// Caller holds sessions_lock
+static void rebuild_session_free(void) {
+    session_free_len = 0;
+    for (int slot = MAX_SESSIONS - 1; slot >= 0; slot--) {
+        MuxSession* s = session_slot(slot);
+        if (s && s->session.socket == -1) session_free[session_free_len++] = slot;
+    }
+}
+
+static MuxSession* alloc_session(void) {
+    MuxSession* s = NULL;
+    pthread_mutex_lock(&sessions_lock);
+    if (session_free_len == 0) {
+        for (int c = 0; c < SESSION_CHUNKS; c++) {
+            if (atomic_load(&session_chunks[c])) continue;
+            if (session_chunk(c)) rebuild_session_free();
+            break;
+        }
+    }
+    if (session_free_len > 0) {
+        int slot = session_free[--session_free_len];
+        s = session_slot(slot);
+        memset(s, 0, sizeof(*s));
+        s->session.socket = MUX_SESSION_BASE + slot;
+        admission_conn_init(&s->session.limits);
+    }
+    pthread_mutex_unlock(&sessions_lock);
+    return s;
+}
+
+static void free_session(MuxSession* s) {
+    pthread_mutex_lock(&sessions_lock);
+    int slot = s->session.socket - MUX_SESSION_BASE;
+    s->session.socket = -1;
+    session_free[session_free_len++] = slot;
+    pthread_mutex_unlock(&sessions_lock);
+}
+
+// Session slot for a sid on a link, -1 if none
+static int link_session_get(int link, long sid) {
+    return sid >= 0 && sid < link_sids_cap[link] ? link_sessions[link][sid] : -1;
+}
+
+// Grows the link's sid map (doubling) to cover sid. Returns -1 if that fails.
+static int link_session_set(int link, int sid, int slot) {
+    if (sid >= link_sids_cap[link]) {
+        int cap = link_sids_cap[link] ? link_sids_cap[link] : 64;
+        while (cap <= sid) cap *= 2;
+        if (cap > MUX_MAX_SIDS) cap = MUX_MAX_SIDS;
+        int* map = realloc(link_sessions[link], (size_t)cap * sizeof(int));
+        if (!map) return -1;
+        for (int i = link_sids_cap[link]; i < cap; i++) map[i] = -1;
+        link_sessions[link] = map;
+        link_sids_cap[link] = cap;
+    }
+    link_sessions[link][sid] = slot;
+    return 0;
+}
+
+static void spawn_handler(Client* c) {
+    c->parked = 0;
+    atomic_fetch_add(&active_handlers, 1);
+    pthread_create(&c->thread, NULL, handle_client, c);
+    pthread_detach(c->thread);
+}
+
+static int wait_for_handlers(int secs) {
+    time_t deadline = time(NULL) + secs;
+    while (atomic_load(&active_handlers) > 0) {
+        if (time(NULL) >= deadline) return -1;
+        poll(NULL, 0, 10);
+    }
+    return 0;
+}
+
+// Restart connections whose handlers parked for a handoff that didn't happen
+static void resume_parked(void) {
+    // A shutdown asked for during the handoff goes ahead now
+    if (stop_mode == SERVER_STOP_RESTART) stop_mode = stop_pending;
+    stop_pending = SERVER_STOP_NONE;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (clients[i].session.socket != -1 && clients[i].parked) spawn_handler(&clients[i]);
+    }
+}
+
+static int games_in_progress(void) {
+    int n = 0;
+    for (int i = 0; i < max_rooms; i++) {
+        if (rooms[i].room_id[0] != '\0' && rooms[i].game_started && !rooms[i].game.game_over) n++;
+    }
+    return n;
+}
+
+static void drain(void) {
+    cluster_leave();
+    close(server_fd);
+    server_fd = -1;
+    printf("Draining: not accepting connections, waiting for %d game(s)\n", games_in_progress());
+    time_t deadline = time(NULL) + DRAIN_TIMEOUT_SECS;
+    while (stop_mode == SERVER_STOP_DRAIN && games_in_progress() > 0 && time(NULL) < deadline) {
+        poll(NULL, 0, STOP_POLL_MS);
+        trace_poll_dump();
+    }
+    stop_mode = SERVER_STOP_CLOSE;
+    if (wait_for_handlers(HANDOFF_TIMEOUT_SECS) < 0) {
+        fprintf(stderr, "Drain: %d handler(s) still busy, exiting anyway\n", atomic_load(&active_handlers));
+    }
+    printf("Server stopped\n");
+}
+
+static int send_with_fd(int sock, const void* data, size_t len, int fd) {
+    struct iovec iov = { (void*)data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, 0)) < 0 && errno == EINTR) {}
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+// Receives one packet; *fd is set to the attached descriptor or -1
+static ssize_t recv_with_fd(int sock, void* data, size_t len, int* fd) {
+    struct iovec iov = { data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    *fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* cm = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+    return n;
+}
+
+static int send_snapshot(int sock) {
+    HandoffHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HANDOFF_MAGIC, 4);
+    hdr.version = HANDOFF_VERSION;
+    hdr.room_size = sizeof(Room);
+    hdr.client_size = sizeof(HandoffClient);
+    hdr.session_size = sizeof(MuxSession);
+    for (int i = 0; i < max_rooms; i++) if (rooms[i].room_id[0] != '\0') hdr.num_rooms++;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) if (clients[i].session.socket != -1) hdr.num_clients++;
+    for (int slot = 0; slot < MAX_SESSIONS; slot++) {
+        MuxSession* ms = session_slot(slot);
+        if (ms && ms->session.socket != -1) hdr.num_sessions++;
+    }
+
+    if (send_with_fd(sock, &hdr, sizeof(hdr), server_fd) < 0) return -1;
+    for (int i = 0; i < max_rooms; i++) {
+        if (rooms[i].room_id[0] != '\0' && send_with_fd(sock, &rooms[i], sizeof(Room), -1) < 0) return -1;
+    }
+    static HandoffClient hc;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (clients[i].session.socket == -1) continue;
+        hc.slot = (uint32_t)i;
+        hc.client = clients[i];
+        if (send_with_fd(sock, &hc, sizeof(hc), clients[i].session.socket) < 0) return -1;
+    }
+    for (int slot = 0; slot < MAX_SESSIONS; slot++) {
+        MuxSession* ms = session_slot(slot);
+        if (!ms || ms->session.socket == -1) continue;
+        if (send_with_fd(sock, ms, sizeof(*ms), -1) < 0) return -1;
+        if (ms->mux_pending_len > 0 && send_with_fd(sock, ms->mux_pending, (size_t)ms->mux_pending_len, -1) < 0) return -1;
+    }
+    return 0;
+}
+
+// Old process side of a hot restart. Returns 0 once the new process owns everything.
+static int hand_off(void) {
+    printf("Hot restart: parking connections\n");
+    if (wait_for_handlers(HANDOFF_TIMEOUT_SECS) < 0) {
+        fprintf(stderr, "Hot restart: handlers busy, aborting\n");
+        resume_parked();
+        return -1;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("socketpair");
+        resume_parked();
+        return -1;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    char fdstr[16];
+    snprintf(fdstr, sizeof(fdstr), "%d", sv[1]);
+    setenv(HANDOFF_ENV, fdstr, 1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(exec_path, exec_argv);
+        _exit(127);
+    }
+    unsetenv(HANDOFF_ENV);
+    close(sv[1]);
+
+    int rc = pid < 0 ? -1 : send_snapshot(sv[0]);
+    if (rc == 0) {
+        // The new process answers 'K' once it has adopted everything
+        struct timeval tv = { HANDOFF_TIMEOUT_SECS, 0 };
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        // A stop signal arriving meanwhile must not abort the handoff (see server_signal_stop)
+        char ack = 0;
+        ssize_t n;
+        while ((n = recv(sv[0], &ack, 1, 0)) < 0 && errno == EINTR) {}
+        if (n != 1 || ack != 'K') rc = -1;
+    }
+    close(sv[0]);
+    if (rc < 0) {
+        fprintf(stderr, "Hot restart: new process (%s) failed, resuming\n", exec_path);
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        resume_parked();
+        return -1;
+    }
+    printf("Hot restart: handed off to pid %d\n", (int)pid);
+    if (stop_pending == SERVER_STOP_DRAIN) {
+        printf("Hot restart: passing the pending drain to pid %d\n", (int)pid);
+        kill(pid, SIGTERM);
+    }
+    return 0;
+}
+
+// New process side of a hot restart: adopt the listener, rooms and connections
+int resume_from_handoff(int handoff_fd) {
+    HandoffHeader hdr;
+    int listen_fd = -1;
+    char nack = 'X';
+    if (recv_with_fd(handoff_fd, &hdr, sizeof(hdr), &listen_fd) != sizeof(hdr) ||
+        memcmp(hdr.magic, HANDOFF_MAGIC, 4) != 0 || hdr.version != HANDOFF_VERSION ||
+        hdr.room_size != sizeof(Room) || hdr.client_size != sizeof(HandoffClient) ||
+        hdr.session_size != sizeof(MuxSession) || hdr.num_rooms > (uint32_t)max_rooms ||
+        hdr.num_clients > MAX_CONNECTIONS || hdr.num_sessions > MAX_SESSIONS || listen_fd < 0) {
+        fprintf(stderr, "Hot restart: incompatible handoff from previous process\n");
+        send(handoff_fd, &nack, 1, 0);
+        close(handoff_fd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < hdr.num_rooms; i++) {
+        int unused;
+        if (recv_with_fd(handoff_fd, &rooms[i], sizeof(Room), &unused) != sizeof(Room)) goto fail;
+        pthread_mutex_init(&rooms[i].lock, NULL);
+    }
+    static HandoffClient hc;
+    static int old_fds[MAX_CONNECTIONS];
+    for (uint32_t i = 0; i < hdr.num_clients; i++) {
+        int fd;
+        if (recv_with_fd(handoff_fd, &hc, sizeof(hc), &fd) != sizeof(hc) || hc.slot >= MAX_CONNECTIONS || fd < 0) goto fail;
+        clients[hc.slot] = hc.client;
+        old_fds[hc.slot] = hc.client.session.socket;
+        clients[hc.slot].session.socket = fd;
+    }
+    // Session handles are slot based, so each session goes back to its old slot
+    for (uint32_t i = 0; i < hdr.num_sessions; i++) {
+        MuxSession ms;
+        int unused;
+        if (recv_with_fd(handoff_fd, &ms, sizeof(ms), &unused) != sizeof(ms)) goto fail;
+        int slot = ms.session.socket - MUX_SESSION_BASE;
+        if (slot < 0 || slot >= MAX_SESSIONS || ms.mux_link < 0 || ms.mux_link >= MUX_MAX_LINKS ||
+            ms.mux_sid < 0 || ms.mux_sid >= MUX_MAX_SIDS || ms.mux_pending_len < 0 || ms.mux_pending_len > MUX_PENDING_BYTES ||
+            !session_chunk(slot / MUX_SESSION_CHUNK)) goto fail;
+        ms.mux_pending = NULL;
+        if (ms.mux_pending_len > 0) {
+            if (!(ms.mux_pending = malloc(MUX_PENDING_BYTES)) ||
+                recv_with_fd(handoff_fd, ms.mux_pending, MUX_PENDING_BYTES, &unused) != ms.mux_pending_len) {
+                free(ms.mux_pending);
+                goto fail;
+            }
+        }
+        *session_slot(slot) = ms;
+    }
+    rebuild_session_free();
+    // Rooms refer to players by socket; the descriptor numbers changed in transit.
+    // Session handles are slot based and stay valid.
+    for (uint32_t r = 0; r < hdr.num_rooms; r++) {
+        for (int p = 0; p < 2; p++) {
+            int old = rooms[r].players[p];
+            if (old == -1 || old >= MUX_SESSION_BASE) continue;
+            int mapped = -1;
+            for (int i = 0; i < MAX_CONNECTIONS; i++) {
+                if (clients[i].session.socket != -1 && old_fds[i] == old) mapped = clients[i].session.socket;
+            }
+            rooms[r].players[p] = mapped;
+        }
+    }
+    // Rebuild the gateway link tables from the adopted clients and sessions
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        Client* c = &clients[i];
+        if (c->session.socket != -1 && c->mux_link >= 0 && c->mux_link < MUX_MAX_LINKS) link_clients[c->mux_link] = i;
+    }
+    for (int slot = 0; slot < MAX_SESSIONS; slot++) {
+        MuxSession* ms = session_slot(slot);
+        if (!ms || ms->session.socket == -1) continue;
+        if (link_clients[ms->mux_link] == -1 || link_session_set(ms->mux_link, ms->mux_sid, slot) < 0) goto fail;
+        admission_session_adopt();
+    }
+
+    server_fd = listen_fd;
+    // Join the directory before the old process exits, so this node never drops out
+    cluster_register();
+    char ack = 'K';
+    send(handoff_fd, &ack, 1, 0);
+    close(handoff_fd);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (clients[i].session.socket == -1) continue;
+        admission_connection_adopt();
+        spawn_handler(&clients[i]);
+    }
+    printf("Hot restart: resumed %u room(s), %u connection(s) and %u gateway session(s)\n",
+           hdr.num_rooms, hdr.num_clients, hdr.num_sessions);
+    return 0;
+
+fail:
+    fprintf(stderr, "Hot restart: truncated handoff from previous process\n");
+    send(handoff_fd, &nack, 1, 0);
+    close(handoff_fd);
+    return -1;
+}
+
+void start_server(void) {
+    if (server_fd >= 0) {
+        printf("Server resumed on inherited listener (TCP %d)\n", listen_port);
+    } else {
+        server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int opt = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(listen_port);
+        if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            exit(1);
+        }
+        if (listen(server_fd, LISTEN_BACKLOG) < 0) {
+            perror("listen");
+            exit(1);
+        }
+        printf("Server listening on TCP %d\n", listen_port);
     }
-    printf("Server listening on TCP %d\n", SERVER_PORT);
+    cluster_register();
     while (1) {
-        int cfd = accept(server_fd, NULL, NULL);
+        int mode = stop_mode;
+        if (mode == SERVER_STOP_RESTART) {
+            if (hand_off() == 0) return;
+            continue;
+        }
+        if (mode != SERVER_STOP_NONE) {
+            drain();
+            return;
+        }
+        // Poll rather than block in accept() so stop requests are noticed promptly
+        trace_poll_dump();
+        struct pollfd pfd = { server_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, STOP_POLL_MS) <= 0) continue;
+        int cfd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
         if (cfd < 0) { perror("accept"); continue; }
-        pthread_t th; pthread_create(&th, NULL, handle_client, (void*)(long)cfd);
-        pthread_detach(th);
+        // Replies are whole lines written at once; Nagle would hold a player's second
+        // update (the opponent's move) until the first is ACKed, ~40 ms on loopback
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int admit = admission_connection_open();
+        if (admit != 0) {
+            // Fast reject: no thread, no reads, just tell the client and hang up
+            send_error(cfd, admit == -1 ? "Server full" : "Server busy, try again later");
+            close(cfd);
+            continue;
+        }
+        Client* c = alloc_client(cfd);
+        if (!c) {
+            send_error(cfd, "Server full");
+            close(cfd);
+            admission_connection_close();
+            continue;
+        }
+        spawn_handler(c);
     }
 }
 
-static int read_line(int fd, char* buf, size_t cap) {
-    size_t off = 0;
-    while (off + 1 < cap) {
-        char ch;
-        ssize_t r = read(fd, &ch, 1);
+// Returns the line length, -1 on EOF/error, -2 when parking for a hot restart,
+// -3 when the server is closing and -4 for a line that doesn't fit in c->inbuf: buf
+// then holds its start, and the rest is dropped through its newline, never returned
+// as a line of its own. Unconsumed input stays in c->inbuf either way.
+static int read_line(Client* c, char* buf, size_t cap) {
+    while (1) {
+        if (c->inbuf_skip) {
+            char* nl = memchr(c->inbuf, '\n', c->inbuf_len);
+            int used = nl ? (int)(nl - c->inbuf) + 1 : c->inbuf_len;
+            memmove(c->inbuf, c->inbuf + used, c->inbuf_len - used);
+            c->inbuf_len -= used;
+            if (nl) c->inbuf_skip = 0;
+        }
+        char* nl = c->inbuf_skip ? NULL : memchr(c->inbuf, '\n', c->inbuf_len);
+        if (nl) {
+            int len = (int)(nl - c->inbuf);
+            int copy = len < (int)cap - 1 ? len : (int)cap - 1;
+            memcpy(buf, c->inbuf, copy);
+            buf[copy] = '\0';
+            memmove(c->inbuf, nl + 1, c->inbuf_len - len - 1);
+            c->inbuf_len -= len + 1;
+            return copy;
+        }
+        if (c->inbuf_len == (int)sizeof(c->inbuf)) {
+            int copy = c->inbuf_len < (int)cap - 1 ? c->inbuf_len : (int)cap - 1;
+            memcpy(buf, c->inbuf, copy);
+            buf[copy] = '\0';
+            c->inbuf_len = 0;
+            c->inbuf_skip = 1;
+            return -4;
+        }
+        int mode = stop_mode;
+        if (mode == SERVER_STOP_RESTART) return -2;
+        if (mode == SERVER_STOP_CLOSE) return -3;
+        struct pollfd pfd = { c->session.socket, POLLIN, 0 };
+        int pr = poll(&pfd, 1, STOP_POLL_MS);
+        if (pr < 0 && errno != EINTR) return -1;
+        if (pr <= 0) continue;
+        ssize_t r = read(c->session.socket, c->inbuf + c->inbuf_len, sizeof(c->inbuf) - c->inbuf_len);
         if (r <= 0) return -1;
-        if (ch == '\n') { buf[off] = '\0'; return (int)off; }
-        buf[off++] = ch;
+        c->inbuf_len += (int)r;
     }
-    buf[cap-1] = '\0';
-    return (int)off;
+}
+
+// Privileged ops need "token" equal to the given environment variable; unset disables them.
+// DAB_ADMIN_TOKEN guards admin ops, DAB_GATEWAY_TOKEN guards MUX_HELLO.
+static int token_authorized(json_object* jobj, const char* env_name) {
+    const char* expected = getenv(env_name);
+    json_object* to;
+    if (!expected || !expected[0] || !json_object_object_get_ex(jobj, "token", &to)) return 0;
+    const char* token = json_object_get_string(to);
+    return token && strcmp(token, expected) == 0;
 }
 
 static void send_error(int fd, const char* msg) {
@@ -177,142 +790,459 @@ static void send_error(int fd, const char* msg) {
     send_message(fd, buf);
 }
 
-void* handle_client(void* arg) {
-    int fd = (int)(long)arg;
-    char username[MAX_USERNAME]; username[0] = '\0';
-    char current_room[MAX_ROOM_ID]; current_room[0] = '\0';
-    char line[BUFFER_SIZE];
-    while (1) {
-        int n = read_line(fd, line, sizeof(line));
-        if (n <= 0) { 
-            cleanup_client(fd);
-            close(fd); 
-            break; 
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int mux_register_link(Client* c) {
+    int link = -1;
+    pthread_mutex_lock(&clients_lock);
+    for (int l = 0; l < MUX_MAX_LINKS; l++) {
+        if (link_clients[l] == -1) {
+            link_clients[l] = (int)(c - clients);
+            link = l;
+            break;
         }
-        json_object* jobj = parse_json_message(line);
-        if (!jobj) { send_error(fd, "Invalid JSON"); continue; }
-        const char* op = get_message_op(jobj);
-        if (!op) { send_error(fd, "Missing op"); free_json_message(jobj); continue; }
-        if (strcmp(op, MSG_LOGIN) == 0) {
-            json_object* uo; if (json_object_object_get_ex(jobj, "user", &uo)) {
-                const char* u = json_object_get_string(uo);
-                strncpy(username, u, MAX_USERNAME-1); username[MAX_USERNAME-1] = '\0';
-                char* reply = create_login_ok_message(fd);
-                send_message(fd, reply); free(reply);
-            } else {
-                send_error(fd, "Missing username");
-            }
+    }
+    pthread_mutex_unlock(&clients_lock);
+    c->mux_link = link;
+    return link;
+}
+
+// Caller holds the link lock
+static void mux_write_close(int link, long sid) {
+    char frame[32];
+    int n = snprintf(frame, sizeof(frame), "C %ld\n", sid);
+    write_all(clients[link_clients[link]].session.socket, frame, (size_t)n);
+}
+
+// Sends a message to a gateway session from any thread. Each frame costs one
+// credit; without credits frames wait in the session's pending buffer, and a
+// session that overflows it is closed rather than buffered without bound.
+static void mux_send(int handle, const char* message) {
+    MuxSession* s = session_for(handle);
+    if (!s) return;
+    int link = s->mux_link;
+    if (link < 0 || link >= MUX_MAX_LINKS) return;
+
+    char frame[BUFFER_SIZE * 2];
+    int n = snprintf(frame, sizeof(frame), "D %d %s", s->mux_sid, message);
+    if (n < 0 || n >= (int)sizeof(frame)) return;
+    if (frame[n - 1] != '\n') frame[n++] = '\n';
+
+    pthread_mutex_lock(&link_locks[link]);
+    if (s->session.socket == handle && !s->mux_closing && link_clients[link] != -1) {
+        if (s->mux_credits > 0 && s->mux_pending_len == 0) {
+            s->mux_credits--;
+            write_all(clients[link_clients[link]].session.socket, frame, (size_t)n);
+        } else if (s->mux_pending_len + n <= MUX_PENDING_BYTES &&
+                   (s->mux_pending || (s->mux_pending = malloc(MUX_PENDING_BYTES)))) {
+            memcpy(s->mux_pending + s->mux_pending_len, frame, (size_t)n);
+            s->mux_pending_len += n;
+        } else {
+            s->mux_closing = 1;
+            s->mux_pending_len = 0;
+            mux_write_close(link, s->mux_sid);
         }
-        else if (strcmp(op, MSG_CREATE_ROOM) == 0) {
-            json_object* ro; if (!username[0]) { send_error(fd, "Not logged in"); }
-            else if (json_object_object_get_ex(jobj, "room_id", &ro)) {
-                const char* rid = json_object_get_string(ro);
-                int grid_size = DEFAULT_GRID_SIZE;
-                json_object* gs;
-                if (json_object_object_get_ex(jobj, "grid_size", &gs)) {
-                    grid_size = json_object_get_int(gs);
-                }
-                
-                if (find_room(rid)) { send_error(fd, "Room exists"); }
-                else {
-                    Room* r = create_room(rid, fd, username, grid_size);
-                    if (!r) { send_error(fd, "No room slots"); }
-                    else {
-                        strncpy(current_room, rid, MAX_ROOM_ID-1); current_room[MAX_ROOM_ID-1] = '\0';
-                        char* msg = create_room_joined_message(rid, 0);
-                        send_message(fd, msg); free(msg);
-                    }
+    }
+    pthread_mutex_unlock(&link_locks[link]);
+}
+
+static void mux_grant(MuxSession* s, int credits) {
+    int link = s->mux_link;
+    pthread_mutex_lock(&link_locks[link]);
+    s->mux_credits += credits;
+    while (s->mux_credits > 0 && s->mux_pending_len > 0 && !s->mux_closing) {
+        char* nl = memchr(s->mux_pending, '\n', (size_t)s->mux_pending_len);
+        int len = (int)(nl - s->mux_pending) + 1;
+        write_all(clients[link_clients[link]].session.socket, s->mux_pending, (size_t)len);
+        memmove(s->mux_pending, s->mux_pending + len, (size_t)(s->mux_pending_len - len));
+        s->mux_pending_len -= len;
+        s->mux_credits--;
+    }
+    pthread_mutex_unlock(&link_locks[link]);
+}
+
+// Link thread only. An open the server can't take is answered with an error and C.
+static void mux_open_session(Client* link_client, int sid) {
+    int link = link_client->mux_link;
+    int admit = admission_session_open();
+    MuxSession* s = admit == 0 ? alloc_session() : NULL;
+    if (s && link_session_set(link, sid, s->session.socket - MUX_SESSION_BASE) < 0) {
+        free_session(s);
+        s = NULL;
+    }
+    if (!s) {
+        if (admit == 0) admission_session_close();
+        char frame[128];
+        int n = snprintf(frame, sizeof(frame), "D %d {\"op\":\"%s\",\"msg\":\"%s\"}\n", sid, MSG_ERROR,
+                         admit == -2 ? "Server busy, try again later" : "Server full");
+        pthread_mutex_lock(&link_locks[link]);
+        write_all(link_client->session.socket, frame, (size_t)n);
+        mux_write_close(link, sid);
+        pthread_mutex_unlock(&link_locks[link]);
+        return;
+    }
+    s->mux_link = link;
+    s->mux_sid = sid;
+    s->mux_credits = MUX_INITIAL_CREDITS;
+}
+
+// Link thread only. notify: tell the gateway (the session is closing from our side).
+static void mux_close_session(MuxSession* s, const char* reason, int notify) {
+    int link = s->mux_link;
+    int handle = s->session.socket;
+    if (reason) send_error(handle, reason);
+    cleanup_client(handle);
+    pthread_mutex_lock(&link_locks[link]);
+    if (notify && !s->mux_closing) mux_write_close(link, s->mux_sid);
+    s->mux_closing = 1;
+    s->mux_pending_len = 0;
+    free(s->mux_pending);
+    s->mux_pending = NULL;
+    link_sessions[link][s->mux_sid] = -1;
+    pthread_mutex_unlock(&link_locks[link]);
+    admission_session_close();
+    free_session(s);
+}
+
+// Appends this process's open rooms to a ROOM_LIST array being built in buf
+static int append_local_rooms(char* response, size_t cap, int pos, int* first) {
+    for (int i = 0; i < max_rooms; i++) {
+        if (rooms[i].room_id[0] != '\0' && !rooms[i].game.game_over) {
+            if ((size_t)pos + 256 >= cap) break;
+            if (!*first) {
+                pos += snprintf(response + pos, cap - pos, ",");
+            }
+            *first = 0;
+            pos += snprintf(response + pos, cap - pos, 
+                            "{\"room_id\":\"%s\",\"player_count\":%d,\"grid_size\":%d,\"status\":\"%s\",\"players\":[",
+                            rooms[i].room_id, rooms[i].player_count, rooms[i].grid_size,
+                            rooms[i].game_started ? "playing" : "waiting");
+            for (int j = 0; j < 2; j++) {
+                if (rooms[i].usernames[j][0] != '\0') {
+                    if (j > 0) pos += snprintf(response + pos, cap - pos, ",");
+                    pos += snprintf(response + pos, cap - pos, "\"%s\"", rooms[i].usernames[j]);
                 }
-            } else { send_error(fd, "Missing room_id"); }
+            }
+            pos += snprintf(response + pos, cap - pos, "]}");
         }
-        else if (strcmp(op, MSG_JOIN_ROOM) == 0) {
-            json_object* ro; if (!username[0]) { send_error(fd, "Not logged in"); }
-            else if (json_object_object_get_ex(jobj, "room_id", &ro)) {
-                const char* rid = json_object_get_string(ro);
-                int rc = join_room(rid, fd, username);
-                if (rc == 0) {
-                    strncpy(current_room, rid, MAX_ROOM_ID-1); current_room[MAX_ROOM_ID-1] = '\0';
-                    char* joined = create_room_joined_message(rid, 1);
-                    send_message(fd, joined); free(joined);
-                    // Start game for both players with names
-                    Room* r = find_room(rid);
-                    if (r) {
-                        char start_msg[256];
-                        snprintf(start_msg, sizeof(start_msg), "{\"op\":\"%s\",\"player1\":\"%s\",\"player2\":\"%s\"}\n", 
-                                 MSG_GAME_START, r->usernames[0], r->usernames[1]);
-                        broadcast_to_room(rid, start_msg, -1);
-                        char* gs = game_state_to_json(&r->game, rid);
-                        broadcast_to_room(rid, gs, -1);
-                        free(gs);
-                    }
-                } else if (rc == -1) {
-                    send_error(fd, "Room not found");
-                } else if (rc == -3) {
-                    send_error(fd, "You are already in this room");
-                } else {
-                    send_error(fd, "Room full");
-                }
-            } else { send_error(fd, "Missing room_id"); }
+    }
+    return pos;
+}
+
+// Cluster mode: whether a CREATE_ROOM/JOIN_ROOM for a room that isn't here goes to
+// another node. A new room goes where the ring places it; an existing one to the node
+// the directory says holds it, wherever the ring has moved since. Returns 1 to
+// redirect to node, 0 to handle it here, -1 if the directory couldn't be asked.
+static int room_elsewhere(const char* op, json_object* jobj, char* node, size_t cap, int query_ms) {
+    json_object* ro;
+    if (!cluster_enabled() || !json_object_object_get_ex(jobj, "room_id", &ro)) return 0;
+    const char* rid = json_object_get_string(ro);
+    if (!rid || find_room(rid)) return 0;
+    if (strcmp(op, MSG_JOIN_ROOM) == 0) return cluster_locate_room(rid, node, cap, query_ms);
+    return !cluster_owner(rid, node, cap);
+}
+
+static void each_local_room(cluster_room_fn fn, void* ctx) {
+    for (int i = 0; i < max_rooms; i++) {
+        char rid[MAX_ROOM_ID];
+        memcpy(rid, rooms[i].room_id, MAX_ROOM_ID);
+        rid[MAX_ROOM_ID - 1] = '\0';
+        if (rid[0]) fn(rid, ctx);
+    }
+}
+
+// Runs one command for a connection or gateway session. conn is the direct
+// connection the command arrived on, NULL for gateway sessions.
+static void run_command(Session* c, Client* conn, const char* line) {
+    int fd = c->socket;
+    char* username = c->username;
+    char* current_room = c->current_room;
+    char node[CLUSTER_ADDR_LEN];
+    int elsewhere = 0;
+    // A gateway session's directory round trip holds up every session on its link
+    int query_ms = conn ? CLUSTER_QUERY_TIMEOUT_MS : CLUSTER_LINK_QUERY_TIMEOUT_MS;
+    trace_event(TRACE_FRAME_RECEIVED, fd, current_room);
+    json_object* jobj = parse_json_message(line);
+    if (!jobj) { send_error(fd, "Invalid JSON"); return; }
+    const char* op = get_message_op(jobj);
+    if (!op) { send_error(fd, "Missing op"); free_json_message(jobj); return; }
+    trace_event(TRACE_PARSED, fd, op);
+    AdmitVerdict verdict = admission_check(&c->limits, admission_classify(op));
+    if (verdict != ADMIT_OK) {
+        send_error(fd, verdict == ADMIT_SHED ? "Server busy, try again later" : "Rate limited");
+        free_json_message(jobj);
+        return;
+    }
+    admission_command_begin();
+    if (strcmp(op, MSG_LOGIN) == 0) {
+        json_object* uo; if (json_object_object_get_ex(jobj, "user", &uo)) {
+            const char* u = json_object_get_string(uo);
+            strncpy(username, u, MAX_USERNAME-1); username[MAX_USERNAME-1] = '\0';
+            char* reply = create_login_ok_message(fd);
+            send_message(fd, reply); free(reply);
+        } else {
+            send_error(fd, "Missing username");
         }
-        else if (strcmp(op, MSG_LIST_ROOMS) == 0) {
-            // Build JSON array of active rooms
-            char response[BUFFER_SIZE];
-            int pos = snprintf(response, sizeof(response), "{\"op\":\"%s\",\"rooms\":[", MSG_ROOM_LIST);
-            int first = 1;
-            for (int i = 0; i < MAX_ROOMS; i++) {
-                if (rooms[i].room_id[0] != '\0' && !rooms[i].game.game_over) {
-                    if (!first) {
-                        pos += snprintf(response + pos, sizeof(response) - pos, ",");
-                    }
-                    first = 0;
-                    pos += snprintf(response + pos, sizeof(response) - pos, 
-                                    "{\"room_id\":\"%s\",\"player_count\":%d,\"grid_size\":%d,\"status\":\"%s\",\"players\":[",
-                                    rooms[i].room_id, rooms[i].player_count, rooms[i].grid_size,
-                                    rooms[i].game_started ? "playing" : "waiting");
-                    for (int j = 0; j < 2; j++) {
-                        if (rooms[i].usernames[j][0] != '\0') {
-                            if (j > 0) pos += snprintf(response + pos, sizeof(response) - pos, ",");
-                            pos += snprintf(response + pos, sizeof(response) - pos, "\"%s\"", rooms[i].usernames[j]);
-                        }
-                    }
-                    pos += snprintf(response + pos, sizeof(response) - pos, "]}");
-                }
-            }
-            pos += snprintf(response + pos, sizeof(response) - pos, "]}\n");
-            send_message(fd, response);
+    }
+    else if ((strcmp(op, MSG_CREATE_ROOM) == 0 || strcmp(op, MSG_JOIN_ROOM) == 0) &&
+             (elsewhere = room_elsewhere(op, jobj, node, sizeof(node), query_ms)) != 0) {
+        if (elsewhere < 0) { send_error(fd, "Room directory unavailable"); }
+        else {
+            json_object* ro;
+            json_object_object_get_ex(jobj, "room_id", &ro);
+            char* msg = create_redirect_message(json_object_get_string(ro), node);
+            send_message(fd, msg); free(msg);
         }
-        else if (strcmp(op, MSG_PLACE_LINE) == 0) {
-            if (!current_room[0]) { send_error(fd, "Not in a room"); }
+    }
+    else if ((strcmp(op, MSG_CREATE_ROOM) == 0 || strcmp(op, MSG_JOIN_ROOM) == 0) &&
+             (stop_mode == SERVER_STOP_DRAIN || stop_mode == SERVER_STOP_CLOSE)) {
+        // A hot restart keeps taking new games: rooms made before the handoff go with it
+        send_error(fd, "Server draining, no new games");
+    }
+    else if (strcmp(op, MSG_CREATE_ROOM) == 0) {
+        json_object* ro; if (!username[0]) { send_error(fd, "Not logged in"); }
+        else if (json_object_object_get_ex(jobj, "room_id", &ro)) {
+            const char* rid = json_object_get_string(ro);
+            int grid_size = DEFAULT_GRID_SIZE;
+            json_object* gs;
+            if (json_object_object_get_ex(jobj, "grid_size", &gs)) {
+                grid_size = json_object_get_int(gs);
+            }
+            
+            PendingRoom pending;
+            int reserved = reserve_room_id(&pending, rid);
+            int claim = reserved ? cluster_claim_room(rid, node, sizeof(node), query_ms) : 0;
+            if (claim == 0) { send_error(fd, "Room exists"); }
+            else if (claim < 0) { send_error(fd, "Room directory unavailable"); }
             else {
-                Room* r = find_room(current_room);
-                if (!r) { send_error(fd, "Room not found"); }
+                Room* r = create_room(rid, fd, username, grid_size);
+                if (!r) { cluster_release_room(rid); send_error(fd, "No room slots"); }
                 else {
-                    json_object* xo; json_object* yo; json_object* oo;
-                    if (json_object_object_get_ex(jobj, "x", &xo) && json_object_object_get_ex(jobj, "y", &yo) && json_object_object_get_ex(jobj, "orientation", &oo)) {
-                        int x = json_object_get_int(xo); int y = json_object_get_int(yo);
-                        const char* o = json_object_get_string(oo);
-                        int player = (fd == r->players[0]) ? 0 : 1;
-                        int rc = place_line(&r->game, x, y, o, player);
-                        if (rc == 0) {
-                            char* gs = game_state_to_json(&r->game, current_room);
-                            broadcast_to_room(current_room, gs, -1);
-                            free(gs);
-                        } else if (rc == -2) {
-                            send_error(fd, "Line already placed");
-                        } else {
-                            send_error(fd, "Invalid move");
-                        }
-                    } else { send_error(fd, "Invalid PLACE_LINE"); }
+                    strncpy(current_room, rid, MAX_ROOM_ID-1); current_room[MAX_ROOM_ID-1] = '\0';
+                    char* msg = create_room_joined_message(rid, 0);
+                    send_message(fd, msg); free(msg);
+                }
+            }
+            if (reserved) unreserve_room_id(&pending);
+        } else { send_error(fd, "Missing room_id"); }
+    }
+    else if (strcmp(op, MSG_JOIN_ROOM) == 0) {
+        json_object* ro; if (!username[0]) { send_error(fd, "Not logged in"); }
+        else if (json_object_object_get_ex(jobj, "room_id", &ro)) {
+            const char* rid = json_object_get_string(ro);
+            int rc = join_room(rid, fd, username);
+            if (rc == 0) {
+                strncpy(current_room, rid, MAX_ROOM_ID-1); current_room[MAX_ROOM_ID-1] = '\0';
+                char* joined = create_room_joined_message(rid, 1);
+                send_message(fd, joined); free(joined);
+                // Start game for both players with names
+                Room* r = find_room(rid);
+                trace_event(TRACE_ROOM_RESOLVED, fd, rid);
+                if (r) {
+                    char start_msg[256];
+                    snprintf(start_msg, sizeof(start_msg), "{\"op\":\"%s\",\"player1\":\"%s\",\"player2\":\"%s\"}\n", 
+                             MSG_GAME_START, r->usernames[0], r->usernames[1]);
+                    broadcast_to_room(rid, start_msg, -1);
+                    char* gs = game_state_to_json(&r->game, rid);
+                    trace_event(TRACE_SERIALIZED, fd, rid);
+                    broadcast_to_room(rid, gs, -1);
+                    free(gs);
                 }
+            } else if (rc == -1) {
+                send_error(fd, "Room not found");
+            } else if (rc == -3) {
+                send_error(fd, "You are already in this room");
+            } else {
+                send_error(fd, "Room full");
+            }
+        } else { send_error(fd, "Missing room_id"); }
+    }
+    else if (strcmp(op, MSG_LIST_ROOMS) == 0) {
+        // Build JSON array of active rooms; in cluster mode the other nodes' rooms too
+        // (peers ask each other with "local":true)
+        char response[CLUSTER_LIST_BYTES];
+        int pos = snprintf(response, sizeof(response), "{\"op\":\"%s\",\"rooms\":[", MSG_ROOM_LIST);
+        int first = 1;
+        pos = append_local_rooms(response, sizeof(response) - 4, pos, &first);
+        json_object* lo;
+        int local_only = json_object_object_get_ex(jobj, "local", &lo) && json_object_get_boolean(lo);
+        if (!local_only) pos = cluster_peer_rooms(response, sizeof(response) - 4, pos, &first);
+        snprintf(response + pos, sizeof(response) - pos, "]}\n");
+        send_message(fd, response);
+    }
+    else if (strcmp(op, MSG_PLACE_LINE) == 0) {
+        if (!current_room[0]) { send_error(fd, "Not in a room"); }
+        else {
+            Room* r = find_room(current_room);
+            trace_event(TRACE_ROOM_RESOLVED, fd, current_room);
+            if (!r) { send_error(fd, "Room not found"); }
+            else {
+                json_object* xo; json_object* yo; json_object* oo;
+                if (json_object_object_get_ex(jobj, "x", &xo) && json_object_object_get_ex(jobj, "y", &yo) && json_object_object_get_ex(jobj, "orientation", &oo)) {
+                    int x = json_object_get_int(xo); int y = json_object_get_int(yo);
+                    const char* o = json_object_get_string(oo);
+                    int player = (fd == r->players[0]) ? 0 : 1;
+                    int rc = place_line(&r->game, x, y, o, player);
+                    trace_event(TRACE_MOVE_APPLIED, fd, current_room);
+                    if (rc == 0) {
+                        char* gs = game_state_to_json(&r->game, current_room);
+                        trace_event(TRACE_SERIALIZED, fd, current_room);
+                        broadcast_to_room(current_room, gs, -1);
+                        free(gs);
+                        if (r->game.game_over) archive_submit(&r->game, r->usernames);
+                    } else if (rc == -2) {
+                        send_error(fd, "Line already placed");
+                    } else {
+                        send_error(fd, "Invalid move");
+                    }
+                } else { send_error(fd, "Invalid PLACE_LINE"); }
             }
         }
-        else if (strcmp(op, MSG_PING) == 0) {
-            char* pong = create_pong_message(); send_message(fd, pong); free(pong);
+    }
+    else if (strcmp(op, MSG_PING) == 0) {
+        char* pong = create_pong_message(); send_message(fd, pong); free(pong);
+    }
+    else if (strcmp(op, MSG_STATS) == 0) {
+        char* stats = admission_stats_to_json(); send_message(fd, stats); free(stats);
+    }
+    else if (strcmp(op, MSG_MUX_HELLO) == 0) {
+        if (!conn || !token_authorized(jobj, "DAB_GATEWAY_TOKEN")) { send_error(fd, "Not authorized"); }
+        else if (mux_register_link(conn) < 0) { send_error(fd, "No gateway slots"); }
+        else {
+            char reply[128];
+            snprintf(reply, sizeof(reply), "{\"op\":\"%s\",\"max_sessions\":%d,\"credits\":%d}\n",
+                     MSG_MUX_READY, MUX_MAX_SIDS, MUX_INITIAL_CREDITS);
+            send_message(fd, reply);
         }
+    }
+    else if (strcmp(op, MSG_TRACE_DUMP) == 0) {
+        if (!token_authorized(jobj, "DAB_ADMIN_TOKEN")) { send_error(fd, "Not authorized"); }
         else {
-            send_error(fd, "Unknown op");
+            char path[512];
+            int events = trace_dump(path, sizeof(path));
+            if (events < 0) { send_error(fd, "Trace unavailable"); }
+            else {
+                char reply[640];
+                snprintf(reply, sizeof(reply), "{\"op\":\"%s\",\"path\":\"%s\",\"events\":%d}\n", MSG_TRACE_DUMP, path, events);
+                send_message(fd, reply);
+            }
         }
-        free_json_message(jobj);
     }
+    else {
+        send_error(fd, "Unknown op");
+    }
+    admission_command_end();
+    free_json_message(jobj);
+}
+
+static void process_line(Session* c, Client* conn, const char* line) {
+    trace_room = c->current_room;
+    run_command(c, conn, line);
+    trace_room = NULL;
+}
+
+// Gateway link loop. Frames are one line each:
+//   O <sid>            open session          C <sid>   close session
+//   D <sid> <json>     command for session   W <sid> <n>  grant n more messages
+static void run_mux_link(Client* c) {
+    int link = c->mux_link;
+    char line[BUFFER_SIZE];
+    while (1) {
+        int n = read_line(c, line, sizeof(line));
+        if (n == -2) {
+            c->parked = 1;
+            return;
+        }
+        // An overlong frame was cut off; only a D frame's session hears about it
+        int overlong = n == -4;
+        if (overlong) n = (int)strlen(line);
+        if (n < 0) break;
+        char* p = line + 1;
+        long sid = strtol(p, &p, 10);
+        if (n < 3 || p == line + 1 || (*p != ' ' && *p != '\0')) continue;
+        if (overlong && line[0] != 'D') continue;
+        if (sid < 0 || sid >= MUX_MAX_SIDS) {
+            // Never silently drop a sid the gateway thinks is open
+            if (line[0] == 'O') {
+                pthread_mutex_lock(&link_locks[link]);
+                mux_write_close(link, sid);
+                pthread_mutex_unlock(&link_locks[link]);
+            }
+            continue;
+        }
+        MuxSession* s = session_slot(link_session_get(link, sid));
+        switch (line[0]) {
+        case 'O':
+            if (!s) mux_open_session(c, (int)sid);
+            break;
+        case 'C':
+            if (s) mux_close_session(s, NULL, 0);
+            break;
+        case 'W':
+            if (s) mux_grant(s, atoi(p));
+            break;
+        case 'D':
+            if (!s || s->mux_closing || *p != ' ') break;
+            if (overlong) send_error(s->session.socket, "Line too long");
+            else process_line(&s->session, NULL, p + 1);
+            break;
+        }
+    }
+
+    // Link gone (or server closing): end every session riding on it
+    int closing = stop_mode == SERVER_STOP_CLOSE;
+    for (int sid = 0; sid < link_sids_cap[link]; sid++) {
+        MuxSession* s = session_slot(link_sessions[link][sid]);
+        if (s) mux_close_session(s, closing ? "Server shutting down" : NULL, closing);
+    }
+    free(link_sessions[link]);
+    link_sessions[link] = NULL;
+    link_sids_cap[link] = 0;
+    pthread_mutex_lock(&link_locks[link]);
+    link_clients[link] = -1;
+    pthread_mutex_unlock(&link_locks[link]);
+    close(c->session.socket);
+    admission_connection_close();
+    free_client(c);
+}
+
+void* handle_client(void* arg) {
+    Client* c = (Client*)arg;
+    int fd = c->session.socket;
+    char line[BUFFER_SIZE];
+    // A gateway link handed over by a hot restart goes straight back to demultiplexing
+    while (c->mux_link < 0) {
+        int n = read_line(c, line, sizeof(line));
+        if (n == -2) {
+            // Parked: connection, session and buffered input go to the new process
+            c->parked = 1;
+            break;
+        }
+        if (n == -4) {
+            send_error(fd, "Line too long");
+            continue;
+        }
+        if (n <= 0) { 
+            if (n == -3) send_error(fd, "Server shutting down");
+            cleanup_client(fd);
+            close(fd); 
+            admission_connection_close();
+            free_client(c);
+            break; 
+        }
+        process_line(&c->session, c, line);
+    }
+    if (c->mux_link >= 0 && !c->parked) run_mux_link(c);
+    trace_thread_release();
+    atomic_fetch_sub(&active_handlers, 1);
     return NULL;
 }
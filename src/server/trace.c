@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include "trace.h"
+
+typedef struct {
+    atomic_int owner;                          // 1 while a thread is recording into it
+    atomic_uint_fast64_t head;                 // Events ever written; slot = head % TRACE_RING_EVENTS
+    TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+static const char* event_names[TRACE_NUM_EVENTS] = {
+    "frame_received", "parsed", "room_resolved", "move_applied", "serialized", "queued", "written"
+};
+
+static TraceRing* rings;
+static int trace_enabled = 0;
+static atomic_ulong untraced_threads;
+static atomic_int dump_seq;
+static volatile sig_atomic_t dump_requested = 0;
+static _Thread_local TraceRing* my_ring;
+static _Thread_local int my_ring_failed;
+
+void trace_init(void) {
+    const char* env = getenv("DAB_TRACE");
+    if (env && strcmp(env, "0") == 0) return;
+    rings = calloc(TRACE_MAX_RINGS, sizeof(TraceRing));
+    if (!rings) return;
+    trace_enabled = 1;
+}
+
+static TraceRing* acquire_ring(void) {
+    for (int i = 0; i < TRACE_MAX_RINGS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&rings[i].owner, &expected, 1)) return &rings[i];
+    }
+    atomic_fetch_add(&untraced_threads, 1);
+    my_ring_failed = 1;
+    return NULL;
+}
+
+void trace_event(TraceEventType type, int conn, const char* tag) {
+    if (!trace_enabled) return;
+    if (!my_ring) {
+        if (my_ring_failed || !(my_ring = acquire_ring())) return;
+    }
+    // Single writer per ring: fill the slot, then publish it by bumping head
+    uint64_t h = atomic_load_explicit(&my_ring->head, memory_order_relaxed);
+    TraceEvent* ev = &my_ring->events[h & (TRACE_RING_EVENTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ev->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    ev->conn = conn;
+    ev->type = (uint16_t)type;
+    if (tag) {
+        strncpy(ev->tag, tag, TRACE_TAG_LEN - 1);
+        ev->tag[TRACE_TAG_LEN - 1] = '\0';
+    } else {
+        ev->tag[0] = '\0';
+    }
+    atomic_store_explicit(&my_ring->head, h + 1, memory_order_release);
+}
+
+void trace_thread_release(void) {
+    // The ring keeps its history; the next thread to pick it up continues after it
+    if (my_ring) atomic_store(&my_ring->owner, 0);
+    my_ring = NULL;
+    my_ring_failed = 0;
+}
+
+void trace_request_dump(void) {
+    // Called from signal handlers
+    dump_requested = 1;
+}
+
+void trace_poll_dump(void) {
+    if (!dump_requested) return;
+    dump_requested = 0;
+    char path[512];
+    if (trace_dump(path, sizeof(path)) >= 0) printf("Trace written to %s\n", path);
+}
+
+// Copy the events of one ring that are stable, i.e. not overwritten while copying
+static int snapshot_ring(TraceRing* ring, TraceEvent* out) {
+    uint64_t end = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t start = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = start; i < end; i++) out[i - start] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t now = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    // Event `now` may be half written already, and it shares a slot with event now - N
+    uint64_t first_valid = now + 1 > TRACE_RING_EVENTS ? now + 1 - TRACE_RING_EVENTS : 0;
+    uint64_t skip = first_valid > start ? first_valid - start : 0;
+    if (skip >= end - start) return 0;
+    memmove(out, out + skip, (size_t)(end - start - skip) * sizeof(TraceEvent));
+    return (int)(end - start - skip);
+}
+
+static void write_tag(FILE* f, const char* tag) {
+    for (const char* p = tag; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', f);
+        if ((unsigned char)*p >= 0x20) fputc(*p, f);
+    }
+}
+
+// Writes every ring as Chrome trace JSON: one thread track per ring, an instant
+// event per trace point and a "command" slice from each frame to its last event.
+int trace_dump(char* path_out, size_t path_cap) {
+    if (!trace_enabled) return -1;
+    const char* dir = getenv("DAB_TRACE_DIR");
+    snprintf(path_out, path_cap, "%s/trace-%d-%ld-%d.json", dir ? dir : TRACE_DEFAULT_DIR,
+             (int)getpid(), (long)time(NULL), atomic_fetch_add(&dump_seq, 1));
+    FILE* f = fopen(path_out, "w");
+    if (!f) { perror("trace dump"); return -1; }
+
+    TraceEvent* buf = malloc(sizeof(TraceEvent) * TRACE_RING_EVENTS);
+    int total = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"dotsandboxes server\"}}",
+            (int)getpid());
+    for (int r = 0; r < TRACE_MAX_RINGS; r++) {
+        int n = snapshot_ring(&rings[r], buf);
+        uint64_t cmd_start = 0, cmd_last = 0;
+        int cmd_conn = -1;
+        for (int i = 0; i <= n; i++) {
+            const TraceEvent* ev = i < n ? &buf[i] : NULL;
+            if (cmd_start && (!ev || ev->type == TRACE_FRAME_RECEIVED)) {
+                fprintf(f, ",\n{\"name\":\"command\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"conn\":%d}}",
+                        (int)getpid(), r, cmd_start / 1000.0, (cmd_last - cmd_start) / 1000.0, cmd_conn);
+                cmd_start = 0;
+            }
+            if (!ev) break;
+            if (ev->type == TRACE_FRAME_RECEIVED) { cmd_start = ev->ts_ns; cmd_conn = ev->conn; }
+            cmd_last = ev->ts_ns;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{\"conn\":%d,\"tag\":\"",
+                    ev->type < TRACE_NUM_EVENTS ? event_names[ev->type] : "unknown",
+                    (int)getpid(), r, ev->ts_ns / 1000.0, ev->conn);
+            write_tag(f, ev->tag);
+            fprintf(f, "\"}}");
+            total++;
+        }
+    }
+    fprintf(f, "\n],\"otherData\":{\"untraced_threads\":%lu}}\n", atomic_load(&untraced_threads));
+    free(buf);
+    fclose(f);
+    return total;
+}
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "game.h"
+#include "game_batch.h"
+
+// bench-batch: check the batch rules engine against place_line(), then compare
+// move throughput of place_line() with each batch kernel the CPU supports.
+
+#define BENCH_DEFAULT_LANES 4096
+#define BENCH_DEFAULT_ROUNDS 20
+#define VERIFY_LANES 1001                      // Odd on purpose, to exercise the scalar tail
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int apply_reference(GameState* game, const GameBatch* batch, unsigned move) {
+    if (move >= (unsigned)batch->num_edges) return place_line(game, -1, -1, NULL, game->current_turn);
+    int x, y;
+    const char* o;
+    batch_edge_coords(batch, (int)move, &x, &y, &o);
+    return place_line(game, x, y, o, game->current_turn);
+}
+
+// Random playouts mixing legal, repeated and out-of-range moves; every step must
+// give the same results and the same positions as place_line().
+static int verify(BatchIsa isa, int size) {
+    GameBatch* batch = batch_create(size, VERIFY_LANES);
+    batch_set_isa(batch, isa);
+    if (batch->isa != isa) { batch_free(batch); return 0; }
+    GameState* ref = malloc(sizeof(GameState) * VERIFY_LANES);
+    uint8_t moves[VERIFY_LANES];
+    int8_t results[VERIFY_LANES];
+    uint64_t legal[VERIFY_LANES];
+    uint32_t completed[VERIFY_LANES];
+    for (int i = 0; i < VERIFY_LANES; i++) {
+        init_game_state(&ref[i], size);
+        batch_load(batch, i, &ref[i]);
+    }
+
+    long checked = 0;
+    int errors = 0;
+    for (int step = 0; step < 4 * MAX_MOVES && !errors; step++) {
+        batch_legal_moves(batch, legal);
+        for (int i = 0; i < VERIFY_LANES; i++) {
+            unsigned r = (unsigned)(rng_next() % 10);
+            if (r == 0) moves[i] = (uint8_t)(batch->num_edges + rng_next() % (256 - batch->num_edges));
+            else if (r == 1) moves[i] = (uint8_t)(rng_next() % batch->num_edges);
+            else {
+                uint64_t open = legal[i];
+                int pick = open ? (int)(rng_next() % __builtin_popcountll(open)) : 0;
+                while (open && pick--) open &= open - 1;
+                moves[i] = open ? (uint8_t)__builtin_ctzll(open) : BATCH_NO_MOVE;
+            }
+        }
+        batch_apply_moves(batch, moves, results);
+        batch_completed_boxes(batch, completed);
+        for (int i = 0; i < VERIFY_LANES && errors < 5; i++) {
+            int expect = apply_reference(&ref[i], batch, moves[i]);
+            GameState got;
+            batch_store(batch, i, &got);
+            uint32_t boxes = 0;
+            for (int by = 0; by < got.rows - 1; by++) {
+                for (int bx = 0; bx < got.cols - 1; bx++) {
+                    if (got.boxes[by][bx] >= 0) boxes |= 1u << (by * (got.cols - 1) + bx);
+                }
+            }
+            if (results[i] != expect || memcmp(&got, &ref[i], offsetof(GameState, moves)) != 0
+                || boxes != completed[i]) {
+                fprintf(stderr, "%s %dx%d: lane %d step %d move %u: result %d, expected %d\n",
+                        batch_isa_name(isa), batch->rows, batch->cols, i, step, moves[i], results[i], expect);
+                errors++;
+            }
+            checked++;
+        }
+    }
+    printf("verify %-7s %dx%d dots: %ld moves %s\n", batch_isa_name(isa), batch->rows, batch->cols,
+           checked, errors ? "FAILED" : "ok");
+    free(ref);
+    batch_free(batch);
+    return errors ? -1 : 0;
+}
+
+// Each lane plays a full random game: moves[step * lanes + lane]
+static uint8_t* make_games(const GameBatch* batch, int lanes) {
+    int n = batch->num_edges;
+    uint8_t* moves = malloc((size_t)n * lanes);
+    uint8_t perm[BATCH_MAX_EDGES];
+    for (int i = 0; i < lanes; i++) {
+        for (int e = 0; e < n; e++) perm[e] = (uint8_t)e;
+        for (int e = n - 1; e > 0; e--) {
+            int j = (int)(rng_next() % (e + 1));
+            uint8_t t = perm[e]; perm[e] = perm[j]; perm[j] = t;
+        }
+        for (int s = 0; s < n; s++) moves[(size_t)s * lanes + i] = perm[s];
+    }
+    return moves;
+}
+
+static double bench_place_line(const GameBatch* shape, const uint8_t* moves, int lanes, int size, int rounds) {
+    GameState* games = malloc(sizeof(GameState) * lanes);
+    int sink = 0;
+    double t0 = now_secs();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < lanes; i++) init_game_state(&games[i], size);
+        for (int s = 0; s < shape->num_edges; s++) {
+            for (int i = 0; i < lanes; i++) sink += apply_reference(&games[i], shape, moves[(size_t)s * lanes + i]);
+        }
+    }
+    double t = now_secs() - t0;
+    if (sink) fprintf(stderr, "place_line rejected %d moves\n", -sink);
+    free(games);
+    return t;
+}
+
+static double bench_batch(BatchIsa isa, const uint8_t* moves, int lanes, int size, int rounds) {
+    GameBatch* batch = batch_create(size, lanes);
+    batch_set_isa(batch, isa);
+    int8_t* results = malloc(lanes);
+    GameState empty;
+    init_game_state(&empty, size);
+    double t0 = now_secs();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < lanes; i++) batch_load(batch, i, &empty);
+        for (int s = 0; s < batch->num_edges; s++) batch_apply_moves(batch, moves + (size_t)s * lanes, results);
+    }
+    double t = now_secs() - t0;
+    free(results);
+    batch_free(batch);
+    return t;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n lanes] [-g grid_size] [-r rounds]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int lanes = BENCH_DEFAULT_LANES, size = DEFAULT_GRID_SIZE, rounds = BENCH_DEFAULT_ROUNDS;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:r:")) != -1) {
+        switch (opt) {
+            case 'n': lanes = atoi(optarg); break;
+            case 'g': size = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (lanes < 1 || rounds < 1) { usage(argv[0]); return 1; }
+
+    GameBatch* shape = batch_create(size, 1);
+    BatchIsa best = shape->isa;
+    printf("Best supported kernel: %s\n", batch_isa_name(best));
+
+    int failed = 0;
+    for (int isa = BATCH_ISA_SCALAR; isa <= (int)best; isa++) {
+        for (int g = 2; g < MAX_GRID_SIZE; g++) failed |= verify((BatchIsa)isa, g);
+    }
+    if (failed) { batch_free(shape); return 1; }
+
+    uint8_t* moves = make_games(shape, lanes);
+    double total = (double)shape->num_edges * lanes * rounds;
+    printf("\n%d games of %dx%d dots, %d rounds (%.0f moves)\n", lanes, shape->rows, shape->cols, rounds, total);
+    double base = bench_place_line(shape, moves, lanes, size, rounds);
+    printf("  %-12s %8.1f M moves/s\n", "place_line", total / base / 1e6);
+    for (int isa = BATCH_ISA_SCALAR; isa <= (int)best; isa++) {
+        double t = bench_batch((BatchIsa)isa, moves, lanes, size, rounds);
+        printf("  batch %-6s %8.1f M moves/s  (%.1fx)\n", batch_isa_name((BatchIsa)isa), total / t / 1e6, base / t);
+    }
+    free(moves);
+    batch_free(shape);
+    return 0;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "common.h"
+#include "game.h"
+#include "cluster.h"
+
+// bench-cluster: play many games at once against a server or cluster and report
+// aggregate moves/s. Each worker drives both players of one room over two
+// connections to the entry node, follows REDIRECTs like the proxy does, and
+// mirrors the game with place_line() to pick legal moves and check the server.
+
+#define BENCH_DEFAULT_PAIRS 40
+#define BENCH_DEFAULT_SECS 10
+#define BENCH_MAX_PAIRS 512
+#define BENCH_BACKOFF_MS 50                    // Wait after "Rate limited" / "No room slots" / directory unavailable
+#define BENCH_READ_TIMEOUT_MS 5000
+#define BENCH_MAX_REDIRECTS 3
+#define BENCH_MAX_ERROR_LOGS 10
+
+typedef struct {
+    int fd;
+    char buf[BUFFER_SIZE * 2];
+    int len;
+} Conn;
+
+static char entry[CLUSTER_ADDR_LEN] = "127.0.0.1:50000";
+static int grid_size = DEFAULT_GRID_SIZE;
+static atomic_int running = 1;
+static atomic_ulong total_moves, total_games, total_redirects, total_retries, total_errors;
+static atomic_ulong total_setups, total_setup_us;   // Rooms entered by both players, and the time it took
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void report_error(int worker, const char* what) {
+    if (atomic_fetch_add(&total_errors, 1) < BENCH_MAX_ERROR_LOGS) fprintf(stderr, "worker %d: %s\n", worker, what);
+}
+
+static void conn_close(Conn* c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+static int conn_open(Conn* c, const char* addr) {
+    char host[CLUSTER_ADDR_LEN], service[16];
+    int port;
+    conn_close(c);
+    if (cluster_parse_addr(addr, host, sizeof(host), &port) < 0) return -1;
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    for (struct addrinfo* ai = res; ai && c->fd < 0; ai = ai->ai_next) {
+        c->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (c->fd >= 0 && connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0) conn_close(c);
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+static int conn_send(Conn* c, const char* line) {
+    size_t len = strlen(line);
+    return write(c->fd, line, len) == (ssize_t)len ? 0 : -1;
+}
+
+// Next message from the connection; *op points into it. NULL on EOF or timeout.
+static json_object* conn_read(Conn* c, const char** op) {
+    while (1) {
+        char* nl = memchr(c->buf, '\n', (size_t)c->len);
+        if (nl) {
+            *nl = '\0';
+            json_object* jobj = json_tokener_parse(c->buf);
+            int used = (int)(nl - c->buf) + 1;
+            memmove(c->buf, c->buf + used, (size_t)(c->len - used));
+            c->len -= used;
+            json_object* oo;
+            if (jobj && json_object_object_get_ex(jobj, "op", &oo)) {
+                *op = json_object_get_string(oo);
+                return jobj;
+            }
+            if (jobj) json_object_put(jobj);
+            continue;
+        }
+        if (c->len == (int)sizeof(c->buf)) return NULL;
+        struct pollfd pfd = { c->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, BENCH_READ_TIMEOUT_MS) <= 0) return NULL;
+        ssize_t r = read(c->fd, c->buf + c->len, sizeof(c->buf) - (size_t)c->len);
+        if (r <= 0) return NULL;
+        c->len += (int)r;
+    }
+}
+
+static const char* error_text(json_object* jobj) {
+    json_object* mo;
+    return json_object_object_get_ex(jobj, "msg", &mo) ? json_object_get_string(mo) : "error";
+}
+
+// Logs in and sends CREATE_ROOM/JOIN_ROOM, starting at the entry node and following
+// REDIRECTs. Returns 0 once in the room, else -1 with the reason in err.
+static int enter_room(Conn* c, const char* op, const char* room_id, const char* user, char* err, size_t err_cap) {
+    char addr[CLUSTER_ADDR_LEN];
+    strcpy(addr, entry);
+    for (int hop = 0; hop <= BENCH_MAX_REDIRECTS; hop++) {
+        if (conn_open(c, addr) < 0) {
+            snprintf(err, err_cap, "cannot connect to %s", addr);
+            return -1;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "{\"op\":\"%s\",\"user\":\"%s\"}\n{\"op\":\"%s\",\"room_id\":\"%s\",\"grid_size\":%d}\n",
+                 MSG_LOGIN, user, op, room_id, grid_size);
+        if (conn_send(c, line) < 0) {
+            snprintf(err, err_cap, "write to %s failed", addr);
+            return -1;
+        }
+        int redirected = 0;
+        while (!redirected) {
+            const char* reply;
+            json_object* jobj = conn_read(c, &reply);
+            if (!jobj) {
+                snprintf(err, err_cap, "no reply from %s", addr);
+                return -1;
+            }
+            int rc = 1;
+            if (strcmp(reply, MSG_ROOM_JOINED) == 0) {
+                rc = 0;
+            } else if (strcmp(reply, MSG_REDIRECT) == 0) {
+                json_object* no;
+                if (json_object_object_get_ex(jobj, "node", &no)) {
+                    strncpy(addr, json_object_get_string(no), sizeof(addr) - 1);
+                    addr[sizeof(addr) - 1] = '\0';
+                }
+                atomic_fetch_add(&total_redirects, 1);
+                redirected = 1;
+            } else if (strcmp(reply, MSG_ERROR) == 0) {
+                snprintf(err, err_cap, "%s", error_text(jobj));
+                rc = -1;
+            }
+            json_object_put(jobj);
+            if (rc <= 0) return rc;
+        }
+    }
+    snprintf(err, err_cap, "too many redirects");
+    return -1;
+}
+
+// Skips messages (GAME_START, ROOM_JOINED...) up to the next GAME_STATE or ERROR
+static json_object* read_state(Conn* c, const char** op) {
+    while (1) {
+        json_object* jobj = conn_read(c, op);
+        if (!jobj || strcmp(*op, MSG_GAME_STATE) == 0 || strcmp(*op, MSG_ERROR) == 0) return jobj;
+        json_object_put(jobj);
+    }
+}
+
+static int random_move(const GameState* g, unsigned* seed, int* x, int* y, const char** o) {
+    int open = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        int pick = pass ? (int)(rand_r(seed) % (unsigned)open) : -1;
+        for (int r = 0; r < g->rows; r++) {
+            for (int c = 0; c < g->cols - 1; c++) {
+                if (g->horizontal[r][c]) continue;
+                if (pass && pick-- == 0) { *x = c; *y = r; *o = ORIENTATION_HORIZONTAL; return 0; }
+                if (!pass) open++;
+            }
+        }
+        for (int r = 0; r < g->rows - 1; r++) {
+            for (int c = 0; c < g->cols; c++) {
+                if (g->vertical[r][c]) continue;
+                if (pass && pick-- == 0) { *x = c; *y = r; *o = ORIENTATION_VERTICAL; return 0; }
+                if (!pass) open++;
+            }
+        }
+        if (!open) return -1;
+    }
+    return -1;
+}
+
+static void play_game(int id, Conn p[2], unsigned* seed) {
+    GameState g;
+    init_game_state(&g, grid_size);
+    const char* op;
+    for (int k = 0; k < 2; k++) {
+        json_object* jobj = read_state(&p[k], &op);
+        int ok = jobj && strcmp(op, MSG_GAME_STATE) == 0;
+        if (jobj) json_object_put(jobj);
+        if (!ok) { report_error(id, "game did not start"); return; }
+    }
+    while (!g.game_over && atomic_load(&running)) {
+        int x, y;
+        const char* o;
+        if (random_move(&g, seed, &x, &y, &o) < 0) { report_error(id, "no legal move left"); return; }
+        char line[128];
+        snprintf(line, sizeof(line), "{\"op\":\"%s\",\"x\":%d,\"y\":%d,\"orientation\":\"%s\"}\n", MSG_PLACE_LINE, x, y, o);
+        Conn* mover = &p[g.current_turn];
+        if (conn_send(mover, line) < 0) { report_error(id, "connection lost"); return; }
+        json_object* jobj = read_state(mover, &op);
+        if (!jobj) { report_error(id, "no reply to move"); return; }
+        if (strcmp(op, MSG_ERROR) == 0) {
+            int limited = strcmp(error_text(jobj), "Rate limited") == 0;
+            if (!limited) report_error(id, error_text(jobj));
+            json_object_put(jobj);
+            if (!limited) return;
+            atomic_fetch_add(&total_retries, 1);
+            sleep_ms(BENCH_BACKOFF_MS);
+            continue;
+        }
+        json_object_put(jobj);
+        jobj = read_state(&p[1 - g.current_turn], &op);
+        if (!jobj || strcmp(op, MSG_GAME_STATE) != 0) {
+            if (jobj) json_object_put(jobj);
+            report_error(id, "opponent missed the update");
+            return;
+        }
+        place_line(&g, x, y, o, g.current_turn);
+        json_object* to;
+        int turn = json_object_object_get_ex(jobj, "turn", &to) ? json_object_get_int(to) : -1;
+        json_object_put(jobj);
+        if (turn != g.current_turn) { report_error(id, "server and local game disagree"); return; }
+        atomic_fetch_add(&total_moves, 1);
+    }
+    if (g.game_over) atomic_fetch_add(&total_games, 1);
+}
+
+static void* worker(void* arg) {
+    int id = (int)(intptr_t)arg;
+    Conn p[2] = { { .fd = -1 }, { .fd = -1 } };
+    unsigned seed = (unsigned)id * 7919u + (unsigned)time(NULL);
+    char users[2][MAX_USERNAME];
+    snprintf(users[0], sizeof(users[0]), "bench%d-a", id);
+    snprintf(users[1], sizeof(users[1]), "bench%d-b", id);
+    for (int n = 0; atomic_load(&running); n++) {
+        char room_id[MAX_ROOM_ID], err[128];
+        snprintf(room_id, sizeof(room_id), "bench-%d-%d", id, n);
+        // Setup: both connects, logins and room commands, redirects and directory lookups included
+        uint64_t start = now_us();
+        if (enter_room(&p[0], MSG_CREATE_ROOM, room_id, users[0], err, sizeof(err)) == 0 &&
+            enter_room(&p[1], MSG_JOIN_ROOM, room_id, users[1], err, sizeof(err)) == 0) {
+            atomic_fetch_add(&total_setup_us, now_us() - start);
+            atomic_fetch_add(&total_setups, 1);
+            play_game(id, p, &seed);
+        } else if (strstr(err, "No room slots") || strstr(err, "busy") || strstr(err, "full") || strstr(err, "Rate limited") ||
+                   strstr(err, "unavailable")) {
+            // Node at capacity or directory away: try another room id, which may land elsewhere
+            atomic_fetch_add(&total_retries, 1);
+            sleep_ms(BENCH_BACKOFF_MS);
+        } else {
+            report_error(id, err);
+            sleep_ms(BENCH_BACKOFF_MS);
+        }
+        conn_close(&p[0]);
+        conn_close(&p[1]);
+    }
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-e host:port] [-p pairs] [-d seconds] [-g grid_size]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int pairs = BENCH_DEFAULT_PAIRS, secs = BENCH_DEFAULT_SECS;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:p:d:g:")) != -1) {
+        switch (opt) {
+            case 'e': strncpy(entry, optarg, sizeof(entry) - 1); break;
+            case 'p': pairs = atoi(optarg); break;
+            case 'd': secs = atoi(optarg); break;
+            case 'g': grid_size = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (pairs < 1 || pairs > BENCH_MAX_PAIRS || secs < 1) { usage(argv[0]); return 1; }
+
+    pthread_t threads[BENCH_MAX_PAIRS];
+    for (int i = 0; i < pairs; i++) pthread_create(&threads[i], NULL, worker, (void*)(intptr_t)i);
+    sleep((unsigned)secs);
+    unsigned long moves = atomic_load(&total_moves), games = atomic_load(&total_games);
+    atomic_store(&running, 0);
+    for (int i = 0; i < pairs; i++) pthread_join(threads[i], NULL);
+
+    unsigned long setups = atomic_load(&total_setups);
+    printf("%d pairs via %s for %ds: %.0f moves/s, %lu games, %.1f ms mean room setup, %lu redirects, %lu retries, %lu errors\n",
+           pairs, entry, secs, (double)moves / secs, games,
+           setups ? (double)atomic_load(&total_setup_us) / setups / 1000.0 : 0.0, atomic_load(&total_redirects),
+           atomic_load(&total_retries), atomic_load(&total_errors));
+    return atomic_load(&total_errors) ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "game.h"
+#include "archive_format.h"
+
+// dab-query: scan a finished-game archive and report per-grid statistics.
+// The file is memory-mapped; worker threads claim batches of blocks and
+// aggregate privately, so the only shared write is the batch counter.
+
+#define QUERY_BATCH_BLOCKS 16
+#define QUERY_MAX_THREADS 256
+#define QUERY_DEFAULT_TOP 5
+
+typedef struct {
+    uint64_t games;
+    uint64_t wins[2];
+    uint64_t draws;
+    uint64_t moves;
+    uint64_t openings[256];
+} GridStats;
+
+typedef struct {
+    GridStats grids[MAX_GRID_SIZE + 1];          // Indexed by dot rows
+    uint64_t skipped_blocks;
+    char pad[64];                                // Keep neighbouring workers off our cache line
+} QueryStats;
+
+static const unsigned char* archive_base;
+static const size_t* block_offsets;
+static size_t num_blocks;
+static atomic_size_t next_block;
+
+static void scan_block(const unsigned char* blk, QueryStats* st) {
+    ArchiveBlockHeader hdr;
+    memcpy(&hdr, blk, sizeof(hdr));
+    if (hdr.codec != ARCHIVE_CODEC_RAW) { st->skipped_blocks++; return; }
+
+    uint32_t n = hdr.num_games;
+    // index_blocks() checked the payload against the mapping; the columns must fit in the payload
+    if ((uint64_t)6 * n > hdr.payload_size) { st->skipped_blocks++; return; }
+    const unsigned char* rows = blk + sizeof(hdr);
+    const signed char* winner = (const signed char*)(rows + 2 * n);
+    const unsigned char* num_moves = rows + 5 * n;
+    const unsigned char* moves = rows + 6 * n;
+    const unsigned char* end = rows + hdr.payload_size;
+
+    for (uint32_t i = 0; i < n; i++) {
+        unsigned r = rows[i];
+        unsigned m = num_moves[i];
+        if (moves + m > end) { st->skipped_blocks++; return; }
+        if (r <= MAX_GRID_SIZE) {
+            GridStats* g = &st->grids[r];
+            g->games++;
+            g->moves += m;
+            if (winner[i] == 0 || winner[i] == 1) g->wins[(int)winner[i]]++;
+            else g->draws++;
+            if (m > 0) g->openings[moves[0]]++;
+        }
+        moves += m;
+    }
+}
+
+static void* query_worker(void* arg) {
+    QueryStats* st = (QueryStats*)arg;
+    while (1) {
+        size_t first = atomic_fetch_add(&next_block, QUERY_BATCH_BLOCKS);
+        if (first >= num_blocks) break;
+        size_t last = first + QUERY_BATCH_BLOCKS;
+        if (last > num_blocks) last = num_blocks;
+        for (size_t b = first; b < last; b++) {
+            scan_block(archive_base + block_offsets[b], st);
+        }
+    }
+    return NULL;
+}
+
+// Walk block headers once to find where every block starts
+static size_t* index_blocks(const unsigned char* base, size_t size, size_t* count) {
+    size_t cap = 1024, n = 0, off = 0;
+    size_t* offs = malloc(cap * sizeof(size_t));
+    while (off + sizeof(ArchiveBlockHeader) <= size) {
+        ArchiveBlockHeader hdr;
+        memcpy(&hdr, base + off, sizeof(hdr));
+        if (memcmp(hdr.magic, ARCHIVE_MAGIC, 4) != 0 || hdr.version != ARCHIVE_VERSION) {
+            fprintf(stderr, "dab-query: bad block header at offset %zu, stopping\n", off);
+            break;
+        }
+        if (off + sizeof(hdr) + hdr.payload_size > size) {
+            fprintf(stderr, "dab-query: truncated block at offset %zu, stopping\n", off);
+            break;
+        }
+        if (n == cap) { cap *= 2; offs = realloc(offs, cap * sizeof(size_t)); }
+        offs[n++] = off;
+        off += sizeof(hdr) + hdr.payload_size;
+    }
+    *count = n;
+    return offs;
+}
+
+static int compare_desc(const void* a, const void* b) {
+    uint64_t x = ((const uint64_t*)a)[0], y = ((const uint64_t*)b)[0];
+    return (x < y) - (x > y);
+}
+
+static void print_report(const QueryStats* total, int top) {
+    printf("\n%-6s %12s %8s %8s %8s %10s\n", "grid", "games", "p1 win%", "p2 win%", "draw%", "avg moves");
+    for (int r = 0; r <= MAX_GRID_SIZE; r++) {
+        const GridStats* g = &total->grids[r];
+        if (!g->games) continue;
+        double n = (double)g->games;
+        printf("%dx%-4d %12llu %8.2f %8.2f %8.2f %10.2f\n", r - 1, r - 1,
+               (unsigned long long)g->games, 100.0 * g->wins[0] / n, 100.0 * g->wins[1] / n,
+               100.0 * g->draws / n, g->moves / n);
+    }
+    for (int r = 0; r <= MAX_GRID_SIZE; r++) {
+        const GridStats* g = &total->grids[r];
+        if (!g->games) continue;
+        uint64_t ranked[256][2];
+        for (int mv = 0; mv < 256; mv++) { ranked[mv][0] = g->openings[mv]; ranked[mv][1] = (uint64_t)mv; }
+        qsort(ranked, 256, sizeof(ranked[0]), compare_desc);
+        printf("\nTop openings %dx%d:\n", r - 1, r - 1);
+        for (int k = 0; k < top && ranked[k][0]; k++) {
+            int mv = (int)ranked[k][1];
+            int idx = mv & ~MOVE_VERTICAL;
+            printf("  %c x=%d y=%d  %12llu  %6.2f%%\n", (mv & MOVE_VERTICAL) ? 'V' : 'H',
+                   idx % MAX_GRID_SIZE, idx / MAX_GRID_SIZE,
+                   (unsigned long long)ranked[k][0], 100.0 * ranked[k][0] / g->games);
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: dab-query [-j threads] [-t top_openings] archive.dab\n");
+}
+
+int main(int argc, char** argv) {
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int top = QUERY_DEFAULT_TOP;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:h")) != -1) {
+        if (opt == 'j') nthreads = atol(optarg);
+        else if (opt == 't') top = atoi(optarg);
+        else { usage(); return opt == 'h' ? 0 : 2; }
+    }
+    if (optind != argc - 1) { usage(); return 2; }
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > QUERY_MAX_THREADS) nthreads = QUERY_MAX_THREADS;
+    if (top > 256) top = 256;
+
+    const char* path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return 1; }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) { perror("fstat"); return 1; }
+    size_t size = (size_t)sb.st_size;
+    if (size == 0) { printf("%s: empty archive\n", path); return 0; }
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { perror("mmap"); return 1; }
+    // Advice values, not flags: one call each
+    madvise(map, size, MADV_SEQUENTIAL);
+    madvise(map, size, MADV_WILLNEED);
+    close(fd);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    archive_base = map;
+    size_t* offs = index_blocks(archive_base, size, &num_blocks);
+    block_offsets = offs;
+    atomic_init(&next_block, 0);
+
+    QueryStats* stats = calloc((size_t)nthreads, sizeof(QueryStats));
+    pthread_t* threads = malloc((size_t)nthreads * sizeof(pthread_t));
+    for (long t = 0; t < nthreads; t++) pthread_create(&threads[t], NULL, query_worker, &stats[t]);
+    for (long t = 0; t < nthreads; t++) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    QueryStats total;
+    memset(&total, 0, sizeof(total));
+    uint64_t games = 0;
+    for (long t = 0; t < nthreads; t++) {
+        total.skipped_blocks += stats[t].skipped_blocks;
+        for (int r = 0; r <= MAX_GRID_SIZE; r++) {
+            GridStats* d = &total.grids[r];
+            const GridStats* s = &stats[t].grids[r];
+            d->games += s->games;
+            d->wins[0] += s->wins[0];
+            d->wins[1] += s->wins[1];
+            d->draws += s->draws;
+            d->moves += s->moves;
+            for (int mv = 0; mv < 256; mv++) d->openings[mv] += s->openings[mv];
+        }
+    }
+    for (int r = 0; r <= MAX_GRID_SIZE; r++) games += total.grids[r].games;
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%s: %zu blocks, %llu games, %.1f MB scanned in %.3f s with %ld threads (%.0f games/s)\n",
+           path, num_blocks, (unsigned long long)games, size / 1e6, secs, nthreads,
+           secs > 0 ? games / secs : 0.0);
+    if (total.skipped_blocks) printf("skipped %llu unreadable blocks\n", (unsigned long long)total.skipped_blocks);
+    print_report(&total, top);
+
+    free(threads);
+    free(stats);
+    free(offs);
+    munmap(map, size);
+    return 0;
+}
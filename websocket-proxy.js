@@ -1,5 +1,14 @@
 // WebSocket to TCP Proxy
 // This bridges WebSocket connections from browser to your C TCP server
+//
+// Two upstream modes:
+//   - default: one TCP connection per browser
+//   - MUX_LINKS=n: n long-lived gateway links to the server, each carrying many
+//     browser sessions as sub-streams (needs GATEWAY_TOKEN = server's DAB_GATEWAY_TOKEN)
+//
+// In cluster mode any node can be the upstream: a REDIRECT for a room on another node
+// is followed here and never reaches the browser. In mux mode the session moves to a
+// gateway link to that node (opened on first use), so it stays multiplexed.
 
 const WebSocket = require('ws');
 const net = require('net');
@@ -7,53 +16,118 @@ const net = require('net');
 const WS_PORT = process.env.WS_PORT ? parseInt(process.env.WS_PORT) : 8080;
 const TCP_HOST = process.env.TCP_HOST || 'localhost';
 const TCP_PORT = process.env.TCP_PORT ? parseInt(process.env.TCP_PORT) : 50000;
+const MUX_LINKS = process.env.MUX_LINKS ? parseInt(process.env.MUX_LINKS) : 0;
+const GATEWAY_TOKEN = process.env.GATEWAY_TOKEN || '';
+const MUX_CREDIT_BATCH = 8;      // Return credits to the server in batches of this many messages
+const MUX_RECONNECT_MS = 1000;
+const MAX_REDIRECTS = 3;         // Per command, guards against nodes disagreeing about placement
+const MAX_LINE_BYTES = 4095 - 'D 999999 '.length;  // Server line limit (BUFFER_SIZE - 1) less the widest D header
 
 const wss = new WebSocket.Server({ port: WS_PORT });
 
 console.log(`🌐 WebSocket proxy listening on ws://0.0.0.0:${WS_PORT}`);
-console.log(`🔌 Forwarding to TCP server at ${TCP_HOST}:${TCP_PORT}`);
+console.log(`🔌 Forwarding to TCP server at ${TCP_HOST}:${TCP_PORT}` + (MUX_LINKS ? ` over ${MUX_LINKS} multiplexed link(s)` : ''));
 console.log('');
 
-wss.on('connection', (ws) => {
-    const remote = ws._socket && ws._socket.remoteAddress ? ws._socket.remoteAddress : 'unknown';
-    console.log('✅ WebSocket client connected from', remote);
-    
+// ---- Cluster redirects ----
+// A node answers CREATE_ROOM/JOIN_ROOM for a room it doesn't own with
+// {"op":"REDIRECT","room_id":...,"node":"host:port"}. The browser's session moves to
+// that node (a direct connection, or a gateway link in mux mode): the login is
+// replayed (its LOGIN_OK swallowed) and the room command resent.
+
+function parseRedirect(line) {
+    if (line.indexOf('"REDIRECT"') < 0) return null;
+    try {
+        const msg = JSON.parse(line);
+        return msg.op === 'REDIRECT' && msg.node ? msg.node : null;
+    } catch (e) {
+        return null;
+    }
+}
+
+// Remembers what a redirect has to replay
+function trackCommand(session, line) {
+    let msg = null;
+    try { msg = JSON.parse(line); } catch (e) { return; }
+    if (!msg) return;
+    if (msg.op === 'LOGIN') session.login = line;
+    else if (msg.op === 'CREATE_ROOM' || msg.op === 'JOIN_ROOM') {
+        session.roomCommand = line;
+        session.redirects = 0;
+    }
+}
+
+function redirectAllowed(session) {
+    if (session.roomCommand && ++session.redirects <= MAX_REDIRECTS) return true;
+    session.ws.send(JSON.stringify({ op: 'ERROR', msg: 'Proxy could not reach the room\'s node' }) + '\n');
+    return false;
+}
+
+function followRedirect(session, node) {
+    if (!redirectAllowed(session)) return;
+    const sep = node.lastIndexOf(':');
+    const host = node.slice(0, sep);
+    const port = parseInt(node.slice(sep + 1));
+    console.log('↪️  Redirecting', session.remote, 'to', node);
+    if (session.tcp) {
+        const old = session.tcp;
+        old.removeAllListeners('close');
+        old.removeAllListeners('data');
+        old.end();
+    }
+    connectDirect(session, host, port);
+    if (session.login) {
+        session.swallowLoginOk = true;
+        session.tcp.write(session.login + '\n');
+    }
+    session.tcp.write(session.roomCommand + '\n');
+}
+
+// ---- Direct mode: one upstream connection per browser ----
+
+function connectDirect(session, host, port) {
+    const ws = session.ws;
     // Create TCP connection to your C server
-    const tcpClient = net.createConnection({ host: TCP_HOST, port: TCP_PORT }, () => {
-        console.log('✅ Connected to TCP server');
+    const tcpClient = net.createConnection({ host, port }, () => {
+        console.log('✅ Connected to TCP server', host + ':' + port);
     });
-    
-    // Forward WebSocket messages to TCP
-    ws.on('message', (data) => {
-        console.log('WS → TCP:', data.toString());
-        tcpClient.write(data);
-    });
-    
-    // Forward TCP messages to WebSocket
+    session.tcp = tcpClient;
+    let buf = '';
+
+    // Forward TCP messages to WebSocket, whole lines at a time
     tcpClient.on('data', (data) => {
-        console.log('TCP → WS:', data.toString());
-        ws.send(data.toString());
-    });
-    
-    // Handle disconnections
-    ws.on('close', () => {
-        console.log('❌ WebSocket client disconnected', remote);
-        tcpClient.end();
+        buf += data.toString();
+        let nl;
+        let out = '';
+        while ((nl = buf.indexOf('\n')) >= 0) {
+            const line = buf.slice(0, nl);
+            buf = buf.slice(nl + 1);
+            const node = parseRedirect(line);
+            if (node) {
+                if (out) ws.send(out);
+                followRedirect(session, node);
+                return;
+            }
+            if (session.swallowLoginOk && line.indexOf('"LOGIN_OK"') >= 0) {
+                session.swallowLoginOk = false;
+                continue;
+            }
+            out += line + '\n';
+        }
+        if (out) {
+            console.log('TCP → WS:', out);
+            ws.send(out);
+        }
     });
-    
+
     tcpClient.on('close', () => {
         console.log('❌ TCP connection closed');
         ws.close();
     });
-    
-    // Handle errors
-    ws.on('error', (err) => {
-        console.error('WebSocket error from', remote, ':', err && err.message);
-    });
-    
+
     tcpClient.on('error', (err) => {
         // Print full error object for diagnostics
-        console.error('TCP error (proxy ->', TCP_HOST + ':' + TCP_PORT, ') for ws client', remote, ':', (err && err.message) || err);
+        console.error('TCP error (proxy ->', host + ':' + port, ') for ws client', session.remote, ':', (err && err.message) || err);
         // forward an error message to the ws client if it's open
         try {
             if (ws && ws.readyState === ws.OPEN) {
@@ -61,6 +135,290 @@ wss.on('connection', (ws) => {
             }
         } catch (e) {}
     });
+}
+
+function bridgeDirect(ws, remote) {
+    const session = { ws, remote, tcp: null, login: null, roomCommand: null, redirects: 0, swallowLoginOk: false };
+    connectDirect(session, TCP_HOST, TCP_PORT);
+
+    // Forward WebSocket messages to TCP
+    ws.on('message', (data) => {
+        console.log('WS → TCP:', data.toString());
+        for (const line of data.toString().split('\n')) if (line.trim()) trackCommand(session, line.trim());
+        session.tcp.write(data);
+    });
+
+    // Handle disconnections
+    ws.on('close', () => {
+        console.log('❌ WebSocket client disconnected', remote);
+        session.tcp.end();
+    });
+}
+
+// ---- Mux mode: sessions share a few gateway links per node ----
+// Frames (one per line): "O sid", "C sid", "D sid <json>", "W sid <credits>"
+// The entry node's links are opened at start and reopened when they drop. Links to
+// other nodes are opened on the first redirect there and forgotten once closed.
+
+const ENTRY_NODE = `${TCP_HOST}:${TCP_PORT}`;
+const pools = new Map();         // "host:port" -> { host, port, links, waiting }
+
+function getPool(node) {
+    let pool = pools.get(node);
+    if (!pool) {
+        const sep = node.lastIndexOf(':');
+        pool = { node, host: node.slice(0, sep), port: parseInt(node.slice(sep + 1)), links: [], waiting: [] };
+        pools.set(node, pool);
+        for (let i = 0; i < MUX_LINKS; i++) openLink(pool, i);
+    }
+    return pool;
+}
+
+// Least loaded ready link with a free sid, or null
+function pickLink(pool) {
+    let link = null;
+    for (const l of pool.links) {
+        if (l && l.ready && hasFreeSid(l) && (!link || l.sessions.size < link.sessions.size)) link = l;
+    }
+    return link;
+}
+
+// Hands ready links to sessions waiting to move onto this pool
+function flushWaiting(pool) {
+    let link;
+    while (pool.waiting.length && (link = pickLink(pool))) pool.waiting.shift()(link);
+}
+
+function openLink(pool, index) {
+    const link = { pool, index, sock: null, ready: false, buf: '', sessions: new Map(),
+                   maxSids: 0, nextSid: 0, freeSids: [], freeHead: 0 };
+    const name = `${pool.node}#${index}`;
+    pool.links[index] = link;
+    link.sock = net.createConnection({ host: pool.host, port: pool.port }, () => {
+        link.sock.write(JSON.stringify({ op: 'MUX_HELLO', token: GATEWAY_TOKEN }) + '\n');
+    });
+    link.sock.setNoDelay(true);
+
+    link.sock.on('data', (data) => {
+        link.buf += data.toString();
+        let nl;
+        while ((nl = link.buf.indexOf('\n')) >= 0) {
+            const line = link.buf.slice(0, nl);
+            link.buf = link.buf.slice(nl + 1);
+            if (line) onLinkLine(link, line);
+        }
+    });
+
+    link.sock.on('close', () => {
+        console.log(`❌ Gateway link ${name} closed, ${link.sessions.size} session(s) dropped`);
+        link.ready = false;
+        for (const session of link.sessions.values()) {
+            session.closed = true;
+            session.ws.close();
+        }
+        link.sessions.clear();
+        if (pool.node === ENTRY_NODE) {
+            setTimeout(() => openLink(pool, index), MUX_RECONNECT_MS);
+            return;
+        }
+        pool.links[index] = null;
+        if (pool.links.every((l) => !l)) {
+            // Node gone: sessions still waiting for it fail, the next redirect starts over
+            pools.delete(pool.node);
+            for (const attach of pool.waiting.splice(0)) attach(null);
+        }
+    });
+
+    link.sock.on('error', (err) => {
+        console.error(`Gateway link ${name} error:`, (err && err.message) || err);
+    });
+}
+
+function onLinkLine(link, line) {
+    if (!link.ready) {
+        let msg = null;
+        try { msg = JSON.parse(line); } catch (e) {}
+        if (msg && msg.op === 'MUX_READY') {
+            link.ready = true;
+            link.maxSids = msg.max_sessions;
+            console.log(`✅ Gateway link ${link.pool.node}#${link.index} ready (${msg.max_sessions} sessions)`);
+            flushWaiting(link.pool);
+        } else {
+            console.error(`Gateway link ${link.pool.node}#${link.index} refused:`, line);
+            link.sock.destroy();
+        }
+        return;
+    }
+    const kind = line[0];
+    const rest = line.slice(2);
+    const space = rest.indexOf(' ');
+    const sid = parseInt(space >= 0 ? rest.slice(0, space) : rest);
+    const session = link.sessions.get(sid);
+    if (!session) return;
+    if (kind === 'D') {
+        if (session.ws.readyState !== WebSocket.OPEN) return;
+        const text = rest.slice(space + 1);
+        const node = parseRedirect(text);
+        if (node && redirectAllowed(session)) {
+            // The room lives on another node: leave this link for one to that node
+            link.sock.write(`C ${sid}\n`);
+            releaseSession(session);
+            moveSession(session, node);
+            return;
+        }
+        if (node || (session.swallowLoginOk && text.indexOf('"LOGIN_OK"') >= 0)) {
+            if (!node) session.swallowLoginOk = false;
+            returnCredit(session, link, sid);
+            return;
+        }
+        // Credits go back once the message has left for the browser
+        session.ws.send(text + '\n', () => returnCredit(session, link, sid));
+    } else if (kind === 'C') {
+        // Server closed the session: acknowledge, then drop the browser
+        link.sock.write(`C ${sid}\n`);
+        releaseSession(session);
+        session.ws.close();
+    }
+}
+
+// One more message of (link, sid) handled; the session may have moved on since
+function returnCredit(session, link, sid) {
+    if (session.closed || session.link !== link || session.sid !== sid) return;
+    if (++session.delivered >= MUX_CREDIT_BATCH) {
+        link.sock.write(`W ${sid} ${session.delivered}\n`);
+        session.delivered = 0;
+    }
+}
+
+// Sids never used go first, then closed ones oldest first, so a closed sid is reused
+// as late as possible. freeSids is a queue read from freeHead: O(1) per open.
+function hasFreeSid(link) {
+    return link.nextSid < link.maxSids || link.freeHead < link.freeSids.length;
+}
+
+function takeSid(link) {
+    if (link.nextSid < link.maxSids) return link.nextSid++;
+    const sid = link.freeSids[link.freeHead++];
+    if (link.freeHead >= 1024 && link.freeHead * 2 >= link.freeSids.length) {
+        link.freeSids = link.freeSids.slice(link.freeHead);
+        link.freeHead = 0;
+    }
+    return sid;
+}
+
+function attachSession(session, link) {
+    session.link = link;
+    session.sid = takeSid(link);
+    session.closed = false;
+    session.delivered = 0;
+    link.sessions.set(session.sid, session);
+    link.sock.write(`O ${session.sid}\n`);
+}
+
+function releaseSession(session) {
+    if (session.closed) return;
+    session.closed = true;
+    session.link.sessions.delete(session.sid);
+    session.link.freeSids.push(session.sid);
+}
+
+// Reopens a redirected session on a link to node, replaying the login and the room
+// command; whatever the browser sends meanwhile is held and sent after them
+function moveSession(session, node) {
+    console.log('↪️  Moving', session.remote, 'to', node);
+    session.moving = true;
+    const attach = (link) => {
+        session.moving = false;
+        if (session.ws.readyState !== WebSocket.OPEN) return;
+        if (!link) {
+            session.ws.send(JSON.stringify({ op: 'ERROR', msg: 'Proxy could not reach the room\'s node' }) + '\n');
+            session.ws.close();
+            return;
+        }
+        attachSession(session, link);
+        let out = '';
+        if (session.login) {
+            session.swallowLoginOk = true;
+            out += `D ${session.sid} ${session.login}\n`;
+        }
+        out += `D ${session.sid} ${session.roomCommand}\n`;
+        for (const line of session.held.splice(0)) {
+            trackCommand(session, line);
+            out += `D ${session.sid} ${line}\n`;
+        }
+        link.sock.write(out);
+    };
+    const pool = getPool(node);
+    const link = pickLink(pool);
+    if (link) attach(link);
+    else pool.waiting.push(attach);
+}
+
+function bridgeMux(ws, remote) {
+    const link = pickLink(getPool(ENTRY_NODE));
+    if (!link) {
+        ws.send(JSON.stringify({ op: 'ERROR', msg: 'Proxy has no upstream capacity' }) + '\n');
+        ws.close();
+        return;
+    }
+    const session = { ws, remote, link: null, sid: -1, buf: '', skipping: false, delivered: 0, closed: false, moving: false, held: [],
+                      login: null, roomCommand: null, redirects: 0, swallowLoginOk: false };
+    attachSession(session, link);
+
+    ws.on('message', (data) => {
+        session.buf += data.toString();
+        let nl;
+        let out = '';
+        if (session.skipping) {
+            // Rest of an overlong line: dropped through its newline
+            if ((nl = session.buf.indexOf('\n')) < 0) session.buf = '';
+            else {
+                session.buf = session.buf.slice(nl + 1);
+                session.skipping = false;
+            }
+        }
+        while ((nl = session.buf.indexOf('\n')) >= 0) {
+            const line = session.buf.slice(0, nl).trim();
+            session.buf = session.buf.slice(nl + 1);
+            if (!line) continue;
+            if (Buffer.byteLength(line) > MAX_LINE_BYTES) {
+                // The server would cut it into frames of their own; it never leaves here
+                ws.send(JSON.stringify({ op: 'ERROR', msg: 'Line too long' }) + '\n');
+            } else if (session.moving) {
+                session.held.push(line);
+            } else if (!session.closed) {
+                trackCommand(session, line);
+                out += `D ${session.sid} ${line}\n`;
+            }
+        }
+        if (!session.skipping && Buffer.byteLength(session.buf) > MAX_LINE_BYTES) {
+            ws.send(JSON.stringify({ op: 'ERROR', msg: 'Line too long' }) + '\n');
+            session.buf = '';
+            session.skipping = true;
+        }
+        if (out) session.link.sock.write(out);
+    });
+
+    ws.on('close', () => {
+        if (session.closed) return;
+        session.link.sock.write(`C ${session.sid}\n`);
+        releaseSession(session);
+    });
+}
+
+if (MUX_LINKS > 0) getPool(ENTRY_NODE);
+
+wss.on('connection', (ws) => {
+    const remote = ws._socket && ws._socket.remoteAddress ? ws._socket.remoteAddress : 'unknown';
+    if (!MUX_LINKS) console.log('✅ WebSocket client connected from', remote);
+
+    if (MUX_LINKS > 0) bridgeMux(ws, remote);
+    else bridgeDirect(ws, remote);
+
+    // Handle errors
+    ws.on('error', (err) => {
+        console.error('WebSocket error from', remote, ':', err && err.message);
+    });
 });
 
-console.log('Waiting for connections...');
\ No newline at end of file
+console.log('Waiting for connections...');